@@ -2,12 +2,26 @@
  * Smart Street Light Controller
  * PIC16F877A based system using LDR, PIR, LED, and 16x2 LCD
  * Designed for Proteus simulation and real hardware
+ *
+ * Intensity variant: full brightness on motion at night, off otherwise,
+ * or dimmed to INTENSITY_STANDBY. Build with -DVARIANT_INTENSITY together
+ * with lcd.c, rtc.c and io.c (see config.h).
  */
 
 #include <xc.h>
+#include "config.h"
+#include "lcd.h"
+#include "rtc.h"
+#include "io.h"
 
 /* ================= CONFIGURATION BITS ================= */
+#if CLOCK_PROFILE == CLOCK_32KHZ
+#pragma config FOSC = LP      // 32 kHz watch crystal
+#elif CLOCK_PROFILE == CLOCK_4MHZ
+#pragma config FOSC = XT      // Crystal up to 4 MHz
+#else
 #pragma config FOSC = HS      // High-speed external crystal
+#endif
 #pragma config WDTE = OFF     // Watchdog Timer disabled
 #pragma config PWRTE = ON     // Power-up Timer enabled
 #pragma config BOREN = OFF    // Brown-out Reset disabled
@@ -16,60 +30,24 @@
 #pragma config WRT = OFF
 #pragma config CP = OFF
 
-/* System oscillator frequency (required for delays) */
-#define _XTAL_FREQ 20000000
+#ifndef VARIANT_INTENSITY
+#error "build with -DVARIANT_INTENSITY"
+#endif
 
-/* ================= LCD PIN DEFINITIONS ================= */
-#define LCD_RS RD0
-#define LCD_EN RD3
-#define LCD_D4 RD4
-#define LCD_D5 RD5
-#define LCD_D6 RD6
-#define LCD_D7 RD7
-
-/* ================= GLOBAL TIME VARIABLES ================= */
-volatile unsigned char seconds = 0;
-volatile unsigned char minutes = 0;
-volatile unsigned char hours   = 22;
+#define LOOP_MS 150
 
 /* ================= FUNCTION PROTOTYPES ================= */
 void System_Init(void);
-void Port_Init(void);
-void Timer2_Init(void);
-void Interrupt_Init(void);
-
-void LCD_Init(void);
-void LCD_Command(unsigned char);
-void LCD_Data(unsigned char);
-void LCD_String(const char*);
-void LCD_Clear(void);
-void LCD_SetCursor(unsigned char, unsigned char);
-
 void Update_Display(unsigned char, unsigned char, unsigned char);
 
-/* ================= TIMER2 INTERRUPT SERVICE ROUTINE ================= */
+/* ================= INTERRUPT SERVICE ROUTINE ================= */
 void __interrupt() ISR(void)
 {
-    if(PIR1bits.TMR2IF)
-    {
-        PIR1bits.TMR2IF = 0;   // Clear Timer2 interrupt flag
-
-        seconds++;
-        if(seconds >= 60)
-        {
-            seconds = 0;
-            minutes++;
-
-            if(minutes >= 60)
-            {
-                minutes = 0;
-                hours++;
-
-                if(hours >= 24)
-                    hours = 0;
-            }
-        }
-    }
+#if INPUT_DEBOUNCE
+    if(RTC_Isr() & RTC_EVT_TICK) IO_Tick();
+#else
+    RTC_Isr();
+#endif
 }
 
 /* ================= MAIN PROGRAM ================= */
@@ -77,7 +55,6 @@ void main(void)
 {
     unsigned char isNight;
     unsigned char motion;
-    unsigned char brightness;
 
     System_Init();
 
@@ -91,158 +68,42 @@ void main(void)
     while(1)
     {
         /* Sensor inputs */
-        isNight = PORTBbits.RB0;   // LDR output
-        motion  = PORTDbits.RD2;   // PIR output
+        isNight = LDR_LEVEL;
+        motion  = PIR_LEVEL;
 
-        /* Day mode */
+        /* Day: off. Night: full on motion, standby otherwise */
         if(isNight == 0)
-        {
-            PORTCbits.RC1 = 0;
-            brightness = 0;
-        }
-        /* Night mode */
+            Lamp_Set(0);
         else
-        {
-            if(motion)
-            {
-                PORTCbits.RC1 = 1;
-                brightness = 2;
-            }
-            else
-            {
-                PORTCbits.RC1 = 0;
-                brightness = 0;
-            }
-        }
+            Lamp_Set(motion ? LAMP_FULL : INTENSITY_STANDBY);
 
         Update_Display(isNight, motion, brightness);
-        __delay_ms(150);
+        __delay_ms(LOOP_MS);
     }
 }
 
 /* ================= SYSTEM INITIALIZATION ================= */
 void System_Init(void)
 {
-    Port_Init();
-    Timer2_Init();
-    Interrupt_Init();
-    LCD_Init();
-}
-
-/* ================= I/O PORT CONFIGURATION ================= */
-void Port_Init(void)
-{
-    TRISBbits.TRISB0 = 1;   // LDR input
-    TRISCbits.TRISC1 = 0;   // LED output
-    TRISD = 0x04;           // RD2 input, others LCD outputs
-
-    PORTCbits.RC1 = 0;
-    PORTD = 0x00;
-
-    OPTION_REGbits.nRBPU = 0;   // Enable PORTB pull-ups
-}
-
-/* ================= TIMER2 CONFIGURATION ================= */
-void Timer2_Init(void)
-{
-    T2CON = 0x00;
-    TMR2 = 0;
-    PR2 = 249;                  // Period register
-
-    T2CONbits.T2CKPS0 = 1;      // Prescaler 1:16
-    T2CONbits.T2CKPS1 = 1;
-    T2CONbits.TMR2ON  = 1;      // Enable Timer2
-}
-
-/* ================= INTERRUPT CONFIGURATION ================= */
-void Interrupt_Init(void)
-{
-    INTCON = 0x00;
-    PIE1bits.TMR2IE = 1;    // Enable Timer2 interrupt
+    IO_Init();
+    RTC_Init();
     INTCONbits.PEIE = 1;    // Peripheral interrupts
     INTCONbits.GIE  = 1;    // Global interrupts
-}
-
-/* ================= LCD CONTROL FUNCTIONS ================= */
-void LCD_Init(void)
-{
-    __delay_ms(20);
-    LCD_Command(0x02);  // 4-bit mode
-    LCD_Command(0x28);  // 2-line display
-    LCD_Command(0x0C);  // Display ON
-    LCD_Command(0x06);  // Cursor increment
-    LCD_Command(0x01);  // Clear display
-    __delay_ms(2);
-}
-
-void LCD_Command(unsigned char cmd)
-{
-    LCD_RS = 0;
-
-    LCD_D4 = (cmd >> 4) & 1;
-    LCD_D5 = (cmd >> 5) & 1;
-    LCD_D6 = (cmd >> 6) & 1;
-    LCD_D7 = (cmd >> 7) & 1;
-
-    LCD_EN = 1; __delay_us(1); LCD_EN = 0;
-
-    LCD_D4 = cmd & 1;
-    LCD_D5 = (cmd >> 1) & 1;
-    LCD_D6 = (cmd >> 2) & 1;
-    LCD_D7 = (cmd >> 3) & 1;
-
-    LCD_EN = 1; __delay_us(1); LCD_EN = 0;
-    __delay_ms(2);
-}
-
-void LCD_Data(unsigned char dat)
-{
-    LCD_RS = 1;
-
-    LCD_D4 = (dat >> 4) & 1;
-    LCD_D5 = (dat >> 5) & 1;
-    LCD_D6 = (dat >> 6) & 1;
-    LCD_D7 = (dat >> 7) & 1;
-
-    LCD_EN = 1; __delay_us(1); LCD_EN = 0;
-
-    LCD_D4 = dat & 1;
-    LCD_D5 = (dat >> 1) & 1;
-    LCD_D6 = (dat >> 2) & 1;
-    LCD_D7 = (dat >> 3) & 1;
-
-    LCD_EN = 1; __delay_us(1); LCD_EN = 0;
-    __delay_ms(2);
-}
-
-void LCD_String(const char* str)
-{
-    while(*str)
-        LCD_Data(*str++);
-}
-
-void LCD_Clear(void)
-{
-    LCD_Command(0x01);
-    __delay_ms(2);
-}
-
-void LCD_SetCursor(unsigned char row, unsigned char col)
-{
-    LCD_Command((row == 1 ? 0x80 : 0xC0) + col - 1);
+    LCD_Init();
 }
 
 /* ================= LCD STATUS DISPLAY ================= */
+/* Through the framebuffer: only cells that changed go to the panel */
 void Update_Display(unsigned char isNight,
                     unsigned char motion,
                     unsigned char level)
 {
-    LCD_SetCursor(1,1);
-    LCD_String(isNight ? "Night " : "Day   ");
-    LCD_String("M:");
-    LCD_String(motion ? "YES " : "NO  ");
+    LCD_Put(1,1, isNight ? "Night " : "Day   ");
+    LCD_Put(1,7, "M:");
+    LCD_Put(1,9, motion ? "YES " : "NO  ");
 
-    LCD_SetCursor(2,1);
-    LCD_String("Light:");
-    LCD_String(level == 2 ? "ON   " : "OFF  ");
+    LCD_Put(2,1, "Light:");
+    LCD_Put(2,7, level == 0 ? "OFF  " : level == LAMP_FULL ? "ON   " : "DIM  ");
+
+    LCD_Flush();
 }
@@ -0,0 +1,233 @@
+/*
+ * File:   config.h
+ * Description: Board wiring and driver features shared by lcd.c, rtc.c,
+ *              io.c and the application file of each build
+ * Microcontroller: PIC16F877A
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// Every build is one application file plus lcd.c, rtc.c and io.c (main.c
+// also takes ctrl.c and display.c, which sim/replay.c runs on a PC); the
+// variant is named on the command line and only overrides what differs
+// from the defaults below:
+//   xc8-cc -mcpu=16F877A main.c ctrl.c display.c lcd.c rtc.c io.c
+//   xc8-cc -mcpu=16F877A -DVARIANT_INTENSITY "Auto Light Intensity.c" lcd.c rtc.c io.c
+//   xc8-cc -mcpu=16F877A -DVARIANT_EXTRA "Auto Light extra.c" lcd.c rtc.c io.c
+// add -DPROFILE=1 prof.c to the first for a profiling build.
+// Disabled features compile out of the modules, not just out of main().
+
+// Clock profiles. _XTAL_FREQ follows from CLOCK_PROFILE, and so does the
+// oscillator mode in each application file's config bits. Timer2 reload
+// and prescalers, the PWM period, the LCD waits, the A/D clock and the UART
+// divisor are all derived from _XTAL_FREQ where they are used, and #error
+// checks there reject combinations that cannot work at that clock.
+// CLOCK_32KHZ (LP crystal, battery units) has 8192 instruction cycles a
+// second, too few for a Timer2 tick interrupt, the LCD queue or any
+// standard baud rate, so it defaults to the Timer1 RTC, an on/off lamp and
+// LCD writes from the loop, and main.c drops the UART.
+#define CLOCK_20MHZ    0        // HS
+#define CLOCK_4MHZ     1        // XT
+#define CLOCK_32KHZ    2        // LP
+
+#if defined(VARIANT_INTENSITY)
+// Polled inputs, LCD written from the loop. At night the lamp is on with
+// motion and off otherwise; INTENSITY_STANDBY = LAMP_DIM dims it instead.
+#ifndef INTENSITY_STANDBY
+#define INTENSITY_STANDBY 0
+#endif
+#define INPUT_USE_IRQ  0
+#define LCD_USE_QUEUE  0
+#define SUPERVISED     0
+#define ENERGY_STATS   0
+#elif defined(VARIANT_EXTRA)
+// 4 MHz board: polled inputs, on/off lamp, sunrise/sunset display
+#ifndef CLOCK_PROFILE
+#define CLOCK_PROFILE  CLOCK_4MHZ
+#endif
+#define INPUT_USE_IRQ  0
+#define LCD_USE_QUEUE  0
+#define LAMP_USE_PWM   0
+#define SUPERVISED     0
+#define ENERGY_STATS   0
+#endif
+
+#ifndef CLOCK_PROFILE
+#define CLOCK_PROFILE  CLOCK_20MHZ
+#endif
+
+#if CLOCK_PROFILE == CLOCK_20MHZ
+#define _XTAL_FREQ     20000000
+#elif CLOCK_PROFILE == CLOCK_4MHZ
+#define _XTAL_FREQ     4000000
+#elif CLOCK_PROFILE == CLOCK_32KHZ
+#define _XTAL_FREQ     32768
+#ifndef RTC_USE_TIMER1
+#define RTC_USE_TIMER1 1
+#endif
+#ifndef RTC_T2_HZ
+#define RTC_T2_HZ      128      // PWM time base only: 128 Hz, 256 steps
+#endif
+#ifndef LAMP_USE_PWM
+#define LAMP_USE_PWM   0
+#endif
+#ifndef LCD_USE_QUEUE
+#define LCD_USE_QUEUE  0
+#endif
+#else
+#error "CLOCK_PROFILE must be CLOCK_20MHZ, CLOCK_4MHZ or CLOCK_32KHZ"
+#endif
+
+// Sensor inputs. INPUT_USE_IRQ lets input events run the input tasks at
+// once and RB0/INT (LDR) wake SLEEP.
+// PIR_ON_RB4 is the alternative pin map with the PIR moved from RD2 to
+// RB4 (interrupt-on-change), so motion switches the lamp on from ISR().
+// Leave it 0 for boards wired like AutoLight.pdsprj (PIR on RD2, polled).
+#ifndef INPUT_USE_IRQ
+#define INPUT_USE_IRQ 1
+#endif
+#ifndef PIR_ON_RB4
+#define PIR_ON_RB4    0
+#endif
+
+// RTC time base, see rtc.h. RTC_USE_TIMER1 counts a 32.768 kHz clock on
+// RC0/T1CKI; otherwise Timer2 ticks RTC_T2_HZ times a second.
+#ifndef RTC_USE_TIMER1
+#define RTC_USE_TIMER1 0
+#endif
+#ifndef RTC_T2_HZ
+#define RTC_T2_HZ      125
+#endif
+
+// LOW_POWER (main.c only): main() SLEEPs between scheduler passes instead
+// of spinning and wakes on RB0/INT (LDR), RB-change (PIR) or the 1 s
+// Timer1 RTC tick, so it needs all three; a polled PIR on RD2 or a Timer2
+// tick cannot wake it.
+//
+// Supply current, MCU only, datasheet typical at 5 V (not measured on our
+// boards; the LCD module and the lamp come on top of this):
+//   HS 20 MHz, delay loop      ~7 mA
+//   XT  4 MHz, delay loop      ~1.6 mA
+//   SLEEP, Timer1 async        a few uA, awake ~1 ms per wake-up
+#ifndef LOW_POWER
+#define LOW_POWER      0
+#endif
+
+#if LOW_POWER && !(INPUT_USE_IRQ && PIR_ON_RB4)
+#error "LOW_POWER needs a PIR that can wake SLEEP: INPUT_USE_IRQ and PIR_ON_RB4"
+#endif
+#if LOW_POWER && !RTC_USE_TIMER1
+#error "LOW_POWER needs RTC_USE_TIMER1: Timer2 stops in SLEEP"
+#endif
+
+// Clock at power-up; there is no RTC backup, so it starts at dusk
+#ifndef CLOCK_START_H
+#define CLOCK_START_H  22
+#endif
+
+// Extra lamp zones, one per bit set in ZONE_PINS out of 0x2E: zone n has
+// its PIR on RBn and an on/off lamp driver on RAn (n = 1, 2, 3, 5), next
+// to the dimmed lamp on RC1. Their hold times are in zones[] in ctrl.c.
+// 0 = single lamp, as on AutoLight.pdsprj.
+#ifndef ZONE_PINS
+#define ZONE_PINS 0x00
+#endif
+
+// INPUT_DEBOUNCE: the digital LDR and the inputs not taken by an interrupt
+// are sampled on every Timer2 RTC tick and only change once stable, see
+// io.h. At 1 Hz a Timer1 RTC tick is too slow for it; the LDR is then read
+// once a task pass, a second apart.
+#ifndef INPUT_DEBOUNCE
+#define INPUT_DEBOUNCE (!RTC_USE_TIMER1)
+#endif
+
+// Lamp on RC1. LAMP_USE_PWM drives it from CCP2 in LAMP_LEVELS steps
+// (see io.h); otherwise any level above 0 is simply on.
+#ifndef LAMP_USE_PWM
+#define LAMP_USE_PWM   1
+#endif
+#ifndef LAMP_DIM
+#define LAMP_DIM       5        // night standby, ~1/3 perceived brightness
+#endif
+
+// LDR_USE_ADC: read the LDR divider on RA0/AN0 instead of the digital RB0
+// threshold. ISR() sums the conversions on ADIF and every
+// 2^LDR_OVERSAMPLE_SHIFT of them feeds a shift-only IIR filter. ambient is
+// the filtered 8-bit level, high = bright; a hysteresis band around it
+// makes the day/night decision. Needs the LDR rewired to RA0, so it
+// defaults to 0 for boards wired like AutoLight.pdsprj.
+#ifndef LDR_USE_ADC
+#define LDR_USE_ADC           0
+#endif
+#ifndef LDR_OVERSAMPLE_SHIFT
+#define LDR_OVERSAMPLE_SHIFT  4     // 16 conversions -> one 12-bit sample
+#endif
+#ifndef LDR_IIR_SHIFT
+#define LDR_IIR_SHIFT         3     // y += (x - y) / 8
+#endif
+#ifndef LDR_DARK_LEVEL
+#define LDR_DARK_LEVEL        70    // ambient below this: night
+#endif
+#ifndef LDR_LIGHT_LEVEL
+#define LDR_LIGHT_LEVEL       90    // ambient above this: day
+#endif
+
+// R/W on RD1: set LCD_RW_WIRED to 1 to poll the busy flag. With R/W tied
+// to GND leave it 0 and the driver waits out the HD44780 timings instead.
+#ifndef LCD_RW_WIRED
+#define LCD_RW_WIRED   0
+#endif
+
+// LCD_USE_QUEUE: LCD_Flush() only queues the changed cells and the Timer0
+// ISR clocks them out one nibble per tick (~100 us at 20 MHz, ~50 us with
+// SUPERVISED; always longer than LCD_T_EXEC_US). Set to 0 to write the cells from the main loop.
+#ifndef LCD_USE_QUEUE
+#define LCD_USE_QUEUE  1
+#endif
+
+// SUPERVISED (main.c only): watchdog and brown-out reset on. The WDT
+// takes the shared prescaler at 1:128, about 2.3 s (0.9 s worst case), so
+// Timer0 paces the LCD queue unscaled, 256 Tcy per tick.
+#ifndef SUPERVISED
+#define SUPERVISED     1
+#endif
+
+// TELEM_STREAM_MS (main.c only): default for cfg.stream_ms, the period of
+// unsolicited status frames on a point-to-point UART link. 0 leaves the
+// unit answering polls only; CMD_SET_CONFIG changes it at run time.
+#ifndef TELEM_STREAM_MS
+#define TELEM_STREAM_MS 0
+#endif
+
+// ENERGY_STATS (main.c only): 32-bit lamp and LCD counters in io.c and
+// lcd.c, advanced from the RTC second, logged hourly and read over the
+// UART. Lamp-on time is counted per band of 1 << ENERGY_BAND_SHIFT of
+// the 16 levels: 2, 3 or 4 give four, two or one band. Finer bands do
+// not fit energy page 0 in one frame of the 32-byte TX ring.
+#ifndef ENERGY_STATS
+#define ENERGY_STATS   1
+#endif
+#ifndef ENERGY_BAND_SHIFT
+#define ENERGY_BAND_SHIFT 2
+#endif
+#if ENERGY_BAND_SHIFT < 2 || ENERGY_BAND_SHIFT > 4
+#error "ENERGY_BAND_SHIFT must be 2, 3 or 4"
+#endif
+
+// PROFILE (main.c only): instrumentation build, see prof.h. Link prof.c
+// as well and keep it 0 for production; the hooks then compile to nothing.
+#ifndef PROFILE
+#define PROFILE        0
+#endif
+#if PROFILE && (defined(VARIANT_INTENSITY) || defined(VARIANT_EXTRA))
+#error "PROFILE instruments main.c only; the variants have no hooks or readout"
+#endif
+
+// HIL_PROBES: timing marks on the free RE0-RE2 pins for a logic analyzer
+// on AutoLight.pdsprj or a board, see prof.h. Costs a few cycles per mark.
+#ifndef HIL_PROBES
+#define HIL_PROBES     0
+#endif
+
+#endif
@@ -0,0 +1,632 @@
+/*
+ * File:   ctrl.c
+ * Description: Controller decisions, see ctrl.h
+ * Microcontroller: PIC16F877A
+ */
+
+#include "ctrl.h"
+
+// CRC-8, poly 0x07: UART frames, the configuration block and
+// Wave_Byte()
+const unsigned char crc8_table[256] =
+{
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+    0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+    0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65,
+    0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
+    0xE0, 0xE7, 0xEE, 0xE9, 0xFC, 0xFB, 0xF2, 0xF5,
+    0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+    0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85,
+    0xA8, 0xAF, 0xA6, 0xA1, 0xB4, 0xB3, 0xBA, 0xBD,
+    0xC7, 0xC0, 0xC9, 0xCE, 0xDB, 0xDC, 0xD5, 0xD2,
+    0xFF, 0xF8, 0xF1, 0xF6, 0xE3, 0xE4, 0xED, 0xEA,
+    0xB7, 0xB0, 0xB9, 0xBE, 0xAB, 0xAC, 0xA5, 0xA2,
+    0x8F, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9D, 0x9A,
+    0x27, 0x20, 0x29, 0x2E, 0x3B, 0x3C, 0x35, 0x32,
+    0x1F, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0D, 0x0A,
+    0x57, 0x50, 0x59, 0x5E, 0x4B, 0x4C, 0x45, 0x42,
+    0x6F, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7D, 0x7A,
+    0x89, 0x8E, 0x87, 0x80, 0x95, 0x92, 0x9B, 0x9C,
+    0xB1, 0xB6, 0xBF, 0xB8, 0xAD, 0xAA, 0xA3, 0xA4,
+    0xF9, 0xFE, 0xF7, 0xF0, 0xE5, 0xE2, 0xEB, 0xEC,
+    0xC1, 0xC6, 0xCF, 0xC8, 0xDD, 0xDA, 0xD3, 0xD4,
+    0x69, 0x6E, 0x67, 0x60, 0x75, 0x72, 0x7B, 0x7C,
+    0x51, 0x56, 0x5F, 0x58, 0x4D, 0x4A, 0x43, 0x44,
+    0x19, 0x1E, 0x17, 0x10, 0x05, 0x02, 0x0B, 0x0C,
+    0x21, 0x26, 0x2F, 0x28, 0x3D, 0x3A, 0x33, 0x34,
+    0x4E, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5C, 0x5B,
+    0x76, 0x71, 0x78, 0x7F, 0x6A, 0x6D, 0x64, 0x63,
+    0x3E, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2C, 0x2B,
+    0x06, 0x01, 0x08, 0x0F, 0x1A, 0x1D, 0x14, 0x13,
+    0xAE, 0xA9, 0xA0, 0xA7, 0xB2, 0xB5, 0xBC, 0xBB,
+    0x96, 0x91, 0x98, 0x9F, 0x8A, 0x8D, 0x84, 0x83,
+    0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB,
+    0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3,
+};
+
+cfg_t cfg;
+unsigned int  hold_ticks;
+unsigned int  fade_step_ticks;
+unsigned int  stream_ticks;
+
+unsigned char isNight = 0;
+unsigned char motion = 0;
+unsigned long motion_count = 0;
+unsigned char motion_prev = 0;
+unsigned char sunrise_h = 0, sunrise_m = 0;
+unsigned char sunset_h  = 0, sunset_m  = 0;
+unsigned char log_night = 0xFF;         // isNight as last logged, 0xFF = none
+
+#if LAMP_SCHEDULE
+// Lamp levels through the night. 01:00 to 05:00 stands by at level 3,
+// about 20 % perceived and 3 % duty against cfg.dim's 9 % by default.
+const sched_t sched[] =
+{
+    { SCHED_AT(1, 0), 3,         LAMP_FULL },   // curfew
+    { SCHED_AT(5, 0), SCHED_CFG, LAMP_FULL },   // morning, evening
+};
+#define SCHED_LEN (sizeof(sched) / sizeof(sched[0]))
+
+volatile unsigned char sched_cur;
+unsigned char sched_next;               // entry that starts next
+unsigned int  sched_min;                // minutes after midnight, ISR only
+#endif
+
+#if USE_SUN_PREDICT
+unsigned int  sun_hist[2][SUN_DAYS];    // minutes after midnight
+unsigned char sun_count[2];             // entries held, up to SUN_DAYS
+unsigned char sun_pos[2];               // next entry to write
+unsigned int  sun_pred[2];
+unsigned char sun_near = 1;
+unsigned char sun_pending = 0;          // a far change is being confirmed
+unsigned int  sun_since;                // ticks when it was first seen
+unsigned int  sun_adc_at;               // ticks at the last slow-rate start
+unsigned char sun_cand = 0;             // a transition waits to be learnt
+unsigned int  sun_cand_min;             // its minute of the day
+unsigned long sun_cand_up;              // uptime when it happened
+#endif
+
+#if ZONE_PINS
+// Entries for pins not in ZONE_PINS are skipped
+const zone_t zones[] =
+{
+    { 0x02, 30, 0 },            // RB1 -> RA1
+    { 0x04, 30, 0 },            // RB2 -> RA2
+    { 0x08, 30, 0 },            // RB3 -> RA3
+    { 0x20, 60, 1 },            // RB5 -> RA5, junction pole
+};
+#define ZONE_LEN (sizeof(zones) / sizeof(zones[0]))
+
+unsigned char zone_hold[ZONE_LEN];      // seconds of hold left
+unsigned char zone_on = 0;              // pins held or on standby
+unsigned char zone_seen = 0;            // pins with motion this second
+unsigned int  zone_sec_at = 0;          // ticks at the last countdown
+#endif
+
+#if LAMP_WAVE
+volatile unsigned char wave_hit = 0;    // Wave_Rx() lit the lamp
+volatile unsigned char wave_seen = 0;   // bit 0: pole below, 1: above
+volatile unsigned int  wave_at[2];      // ticks at their last motion
+
+// Wave_Byte() state: A5 src B0 01 dir crc
+const unsigned char wave_head[] = { FRAME_SYNC, 0, CMD_WAVE | FRAME_REPLY, 1 };
+unsigned char wave_pos = 0, wave_src, wave_dir, wave_crc = 0;
+#endif
+
+// Motion hold state, written by Ctrl_Lamp() only
+unsigned char lamp_holding = 0;
+unsigned int  lamp_motion_at = 0;       // ticks at the last motion seen
+#if MOTION_STAMP
+unsigned char lamp_by_pir = 0;          // held for the PIR: motion_stamp
+#endif
+unsigned int  lamp_step_at = 0;         // ticks at the last fade step
+
+#if USE_SUN_PREDICT
+void Sun_Learn(unsigned char, unsigned int);
+unsigned char Sun_Near(unsigned int);
+#endif
+
+// ================= TASKS =================
+// One scheduler pass over the n tasks of t
+void Tasks_Run(task_t* t, unsigned char n)
+{
+    unsigned int now = Ticks_Now();
+    unsigned char pending = 0;
+
+#if INPUT_USE_IRQ
+    pending = input_events;
+#endif
+    for(; n; n--, t++)
+    {
+        if((unsigned int)(now - t->last) >= t->period || (pending && t->on_event))
+        {
+            t->last = now;
+            t->run();
+        }
+    }
+}
+
+// From ISR(): the RTC tick and what runs off it, then the input interrupts
+void Ctrl_Isr(void)
+{
+    unsigned char rtc = RTC_Isr();
+
+#if LAMP_SCHEDULE
+    if(rtc & RTC_EVT_MINUTE) Sched_Minute();
+#endif
+#if INPUT_DEBOUNCE
+    if(rtc & RTC_EVT_TICK) IO_Tick();
+#endif
+#if ENERGY_STATS
+    if(rtc & RTC_EVT_SECOND) Energy_Second();
+#endif
+    (void)rtc;
+    IO_Isr();
+}
+
+// Input task: day/night from the LDR, motion from the PIR
+void Ctrl_Input(void)
+{
+#if LDR_USE_ADC
+    unsigned int now;
+#endif
+#if INPUT_USE_IRQ
+    unsigned char events;
+
+    INTCONbits.GIE = 0;
+    events = input_events;
+    input_events = 0;
+    INTCONbits.GIE = 1;
+#endif
+
+#if LDR_USE_ADC
+    now = Ticks_Now();
+#if USE_SUN_PREDICT
+    if(!ADCON0bits.GO_nDONE && Ctrl_AdcDue(now))
+#else
+    if(!ADCON0bits.GO_nDONE)
+#endif
+        ADCON0bits.GO_nDONE = 1;        // result goes to ISR()
+
+    Ctrl_Ambient(ambient, now);
+#else
+    isNight = LDR_LEVEL;    // LDR, debounced with INPUT_DEBOUNCE
+#endif
+#if INPUT_USE_IRQ
+    ldr_state = isNight;                // for the PIR interrupt
+#endif
+
+#if INPUT_USE_IRQ && PIR_ON_RB4
+    Ctrl_Motion(pir_state || (events & EVT_MOTION));   // keep short pulses
+#else
+#if INPUT_USE_IRQ
+    (void)events;
+#endif
+    Ctrl_Motion(PIR_LEVEL); // PIR
+#endif
+}
+
+// Lamp task: the main lamp and the zones
+void Ctrl_Output(void)
+{
+    unsigned int now = Ticks_Now();
+
+    Ctrl_Lamp(now);
+#if ZONE_PINS
+    Ctrl_Zones(now);
+#endif
+}
+
+// ================= CONFIGURATION =================
+void Config_Defaults(void)
+{
+    cfg.hold_s  = MOTION_HOLD_S;
+    cfg.fade_ms = LAMP_FADE_MS;
+    cfg.dim     = LAMP_DIM;
+    cfg.display = DISP_ROTATE;
+    cfg.start_h = CLOCK_START_H;
+    cfg.dark    = LDR_DARK_LEVEL;
+    cfg.light   = LDR_LIGHT_LEVEL;
+    cfg.stream_ms = TELEM_STREAM_MS;
+    Config_Apply();
+}
+
+// Tick counts for Ctrl_Lamp(), so its hot path only compares
+void Config_Apply(void)
+{
+    hold_ticks      = (unsigned int)(cfg.hold_s * (unsigned long)RTC_TICK_HZ);
+    fade_step_ticks = TICKS_MS(cfg.fade_ms / (LAMP_FULL - cfg.dim));
+    stream_ticks    = TICKS_MS(cfg.stream_ms);
+}
+
+void Config_Pack(unsigned char* b)
+{
+    b[0] = (unsigned char)cfg.hold_s;
+    b[1] = (unsigned char)(cfg.hold_s >> 8);
+    b[2] = (unsigned char)cfg.fade_ms;
+    b[3] = (unsigned char)(cfg.fade_ms >> 8);
+    b[4] = cfg.dim;
+    b[5] = cfg.display;
+    b[6] = cfg.start_h;
+    b[7] = cfg.dark;
+    b[8] = cfg.light;
+    b[9] = (unsigned char)cfg.stream_ms;
+    b[10] = (unsigned char)(cfg.stream_ms >> 8);
+}
+
+// Take the fields only if all of them are in range
+unsigned char Config_Unpack(const unsigned char* b)
+{
+    unsigned int hold = b[0] | ((unsigned int)b[1] << 8);
+    unsigned int stream = b[9] | ((unsigned int)b[10] << 8);
+
+    if(hold > CFG_HOLD_MAX || b[4] >= LAMP_FULL || b[5] > DISP_ROTATE
+       || b[6] > 23 || b[7] >= b[8] || (stream && stream < CFG_STREAM_MIN))
+        return 0;
+
+    cfg.hold_s  = hold;
+    cfg.fade_ms = b[2] | ((unsigned int)b[3] << 8);
+    cfg.dim     = b[4];
+    cfg.display = b[5];
+    cfg.start_h = b[6];
+    cfg.dark    = b[7];
+    cfg.light   = b[8];
+    cfg.stream_ms = stream;
+    Config_Apply();
+    return 1;
+}
+
+// ================= DECISIONS =================
+#if LDR_USE_ADC
+// Filtered LDR level to day/night, with cfg.dark..cfg.light as hysteresis
+void Ctrl_Ambient(unsigned char level, unsigned int now)
+{
+    unsigned char night = isNight;
+
+    if(isNight)
+    {
+        if(level > cfg.light) night = 0;
+    }
+    else if(level < cfg.dark)
+        night = 1;
+
+#if USE_SUN_PREDICT
+    if(night == isNight)
+    {
+        sun_pending = 0;
+        return;
+    }
+    if(!sun_near)
+    {
+        if(!sun_pending)
+        {
+            sun_pending = 1;
+            sun_since = now;
+        }
+        if((unsigned int)(now - sun_since) < TICKS_MS(SUN_CONFIRM_S * 1000UL))
+            return;
+    }
+    sun_pending = 0;
+#else
+    (void)now;
+#endif
+    isNight = night;
+}
+#endif
+
+#if USE_SUN_PREDICT
+// Whether Task_Input should start a conversion now
+unsigned char Ctrl_AdcDue(unsigned int now)
+{
+    if(sun_near || sun_pending) return 1;
+    if((unsigned int)(now - sun_adc_at) < TICKS_MS(SUN_SLOW_MS)) return 0;
+    sun_adc_at = now;
+    return 1;
+}
+
+// Add a transition at minute m of the day and refresh its prediction
+void Sun_Learn(unsigned char k, unsigned int m)
+{
+    unsigned long sum = 0;
+    unsigned char i;
+
+    sun_hist[k][sun_pos[k]] = m;
+    sun_pos[k] = (sun_pos[k] + 1) & (SUN_DAYS - 1);
+    if(sun_count[k] < SUN_DAYS) sun_count[k]++;
+
+    for(i = 0; i < sun_count[k]; i++) sum += sun_hist[k][i];
+    sun_pred[k] = (unsigned int)(sum / sun_count[k]);
+}
+
+// Minute m within SUN_WINDOW_MIN of either prediction, either way round
+// midnight; always while one of them has no history
+unsigned char Sun_Near(unsigned int m)
+{
+    unsigned char k;
+    unsigned int d;
+
+    for(k = 0; k < 2; k++)
+    {
+        if(!sun_count[k]) return 1;
+
+        d = (m >= sun_pred[k]) ? m - sun_pred[k] : sun_pred[k] - m;
+        if(d > SCHED_AT(12, 0)) d = SCHED_AT(24, 0) - d;
+        if(d <= SUN_WINDOW_MIN) return 1;
+    }
+    return 0;
+}
+#endif
+
+#if LAMP_SCHEDULE
+// Find the entry in effect at h:m; call with the RTC interrupt masked or
+// not yet enabled
+void Sched_Init(unsigned char h, unsigned char m)
+{
+    unsigned char i;
+
+    sched_min = SCHED_AT(h, m);
+    sched_cur = SCHED_LEN - 1;          // before the first start: last one
+    for(i = 0; i < SCHED_LEN && sched[i].start <= sched_min; i++)
+        sched_cur = i;
+    sched_next = sched_cur + 1;
+    if(sched_next >= SCHED_LEN) sched_next = 0;
+}
+
+// From ISR() when RTC_Isr() reports a new minute
+void Sched_Minute(void)
+{
+    if(++sched_min >= SCHED_AT(24, 0)) sched_min = 0;
+
+    if(sched_min == sched[sched_next].start)
+    {
+        sched_cur = sched_next;
+        if(++sched_next >= SCHED_LEN) sched_next = 0;
+    }
+}
+#endif
+
+void Ctrl_Motion(unsigned char m)
+{
+    motion = m;
+    if(motion && !motion_prev) motion_count++;
+    motion_prev = motion;
+}
+
+void Ctrl_Lamp(unsigned int now)
+{
+#if LAMP_SCHEDULE
+    const sched_t* s = &sched[sched_cur];
+    unsigned char dim = (s->dim == SCHED_CFG) ? cfg.dim : s->dim;
+    unsigned char boost = s->boost;
+#else
+    unsigned char dim = cfg.dim;
+    unsigned char boost = LAMP_FULL;
+#endif
+#if LAMP_USE_PWM
+    unsigned char level;
+#endif
+
+    // ? DAY
+    if(isNight == 0)
+    {
+        lamp_holding = 0;
+#if LAMP_WAVE
+        wave_hit = 0;
+#endif
+        Lamp_Set(0);
+        return;
+    }
+
+    // ? NIGHT: boost on motion and for hold_ticks after it
+#if LAMP_WAVE
+    if(motion || wave_hit)
+    {
+        wave_hit = 0;
+#else
+    if(motion)
+    {
+#endif
+        lamp_motion_at = now;
+#if MOTION_STAMP
+        lamp_by_pir = motion;
+#endif
+        lamp_holding = 1;
+        Lamp_Set(boost);
+        return;
+    }
+
+    if(lamp_holding)
+    {
+#if MOTION_STAMP
+        if(lamp_by_pir)                 // the ISR saw the motion end
+        {
+            INTCONbits.GIE = 0;
+            lamp_motion_at = motion_stamp;
+            INTCONbits.GIE = 1;
+        }
+#endif
+        if((unsigned int)(now - lamp_motion_at) < hold_ticks)
+            return;
+        lamp_holding = 0;
+        lamp_step_at = now;
+    }
+
+#if LAMP_USE_PWM
+    // fade down to dim standby; one read, as ISR() may set the lamp too
+    INTCONbits.GIE = 0;
+    level = brightness;
+    INTCONbits.GIE = 1;
+
+    if(level > dim)
+    {
+        if((unsigned int)(now - lamp_step_at) >= fade_step_ticks)
+        {
+            lamp_step_at = now;
+            Lamp_Set(level - 1);
+        }
+    }
+    else
+        Lamp_Set(dim);
+#else
+    (void)dim;
+    Lamp_Set(0);
+#endif
+}
+
+// A settled LDR transition becomes the last sunset or sunrise: 1 and its
+// time in t, 0 if there was none since the last call. t gets the current
+// time either way, so callers may use it unchecked.
+unsigned char Ctrl_Sun(rtc_snap_t* t)
+{
+    RTC_Snapshot(t);
+#if LDR_USE_ADC
+    if(!ldr_seeded) return 0;           // no filtered level yet
+#endif
+#if USE_SUN_PREDICT
+    sun_near = Sun_Near(SCHED_AT(t->hours, t->minutes));
+#endif
+    if(log_night == 0xFF)
+    {
+        log_night = isNight;
+        return 0;
+    }
+    if(isNight == log_night)
+    {
+#if USE_SUN_PREDICT
+        if(sun_cand && t->uptime - sun_cand_up >= SUN_SETTLE_MIN * 60UL)
+        {
+            sun_cand = 0;
+            Sun_Learn(isNight ? SUN_SET : SUN_RISE, sun_cand_min);
+        }
+#endif
+        return 0;
+    }
+
+    log_night = isNight;
+    if(isNight)
+    {
+        sunset_h = t->hours;
+        sunset_m = t->minutes;
+    }
+    else
+    {
+        sunrise_h = t->hours;
+        sunrise_m = t->minutes;
+    }
+#if USE_SUN_PREDICT
+    // learnt once it has lasted; a change undone before then was a glitch
+    // and so is the change back
+    if(sun_cand)
+        sun_cand = 0;
+    else
+    {
+        sun_cand = 1;
+        sun_cand_min = SCHED_AT(t->hours, t->minutes);
+        sun_cand_up = t->uptime;
+    }
+#endif
+    return 1;
+}
+
+#if ZONE_PINS
+// Every lamp pass: motion lights a zone at once, bitwise across all of
+// them; the per-zone loop runs only once a second
+void Ctrl_Zones(unsigned int now)
+{
+    unsigned char m = in_stable & ZONE_PINS;
+    unsigned char i, pin;
+
+    zone_seen |= m;
+    if((unsigned int)(now - zone_sec_at) >= RTC_TICK_HZ)
+    {
+        zone_sec_at = now;
+        for(i = 0; i < ZONE_LEN; i++)
+        {
+            pin = zones[i].pin & ZONE_PINS;
+            if(!pin) continue;
+
+            if(zone_seen & pin)    zone_hold[i] = zones[i].hold_s;
+            else if(zone_hold[i]) zone_hold[i]--;
+
+            if(zone_hold[i] || zones[i].standby) zone_on |= pin;
+            else                                zone_on &= ~pin;
+        }
+        zone_seen = m;
+    }
+
+    Zone_Set(isNight ? (m | zone_on) : 0);
+}
+#endif
+
+#if LAMP_WAVE
+// Direction for a local motion onset, from the neighbours' last motion.
+// Stale entries are dropped so a wrapped tick count cannot revive them.
+unsigned char Wave_Direction(unsigned int now)
+{
+    unsigned char dir = WAVE_ANY, k, recent;
+
+    for(k = 0; k < 2; k++)
+    {
+        INTCONbits.GIE = 0;
+        recent = (wave_seen & (1 << k))
+              && (unsigned int)(now - wave_at[k]) < TICKS_MS(WAVE_DIR_MS);
+        if(!recent) wave_seen &= ~(1 << k);
+        INTCONbits.GIE = 1;
+
+        if(recent)
+            dir = (dir == WAVE_ANY && k == 0) ? WAVE_UP
+                : (dir == WAVE_ANY)           ? WAVE_DOWN
+                :                               WAVE_ANY;   // both: unclear
+    }
+    return dir;
+}
+
+// From ISR() on a verified motion broadcast: a few compares, then the
+// lamp comes on at once if it is ahead of the walker
+void Wave_Rx(unsigned char src, unsigned char dir, unsigned char self)
+{
+    unsigned char ahead;
+
+    if(src + 1 == self)      { wave_at[0] = ticks; wave_seen |= 1; }
+    else if(src == self + 1) { wave_at[1] = ticks; wave_seen |= 2; }
+
+    if(dir == WAVE_UP)        ahead = src < self && self - src <= WAVE_AHEAD;
+    else if(dir == WAVE_DOWN) ahead = src > self && src - self <= WAVE_AHEAD;
+    else                      ahead = src + 1 == self || src == self + 1;
+
+    if(ahead && isNight)
+    {
+        wave_hit = 1;
+        Lamp_Set(LAMP_FULL);            // Ctrl_Lamp() holds it from here
+    }
+}
+
+// CMD_WAVE matcher, fed every received byte from ISR(). A byte that
+// breaks the pattern may be the next frame's sync, and a sync taken for
+// src is given back when the type does not follow, so neither a cut-off
+// frame nor a stray A5 costs the frame behind it. The CRC restarts
+// whenever the match does.
+void Wave_Byte(unsigned char c, unsigned char self)
+{
+    if(wave_pos == 5)
+    {
+        if(c == wave_crc) Wave_Rx(wave_src, wave_dir, self);
+        wave_pos = 0;
+    }
+    else if(wave_pos == 1 || wave_pos == 4 || c == wave_head[wave_pos])
+    {
+        if(wave_pos == 1)      wave_src = c;
+        else if(wave_pos == 4) wave_dir = c;
+        if(wave_pos) wave_crc = crc8_table[wave_crc ^ c];
+        wave_pos++;
+    }
+    else if(wave_pos == 2 && wave_src == FRAME_SYNC)    // A5 A5 src
+    {
+        wave_src = c;
+        wave_crc = crc8_table[c];
+    }
+    else
+        wave_pos = c == FRAME_SYNC;
+    if(wave_pos <= 1) wave_crc = 0;     // CRC covers src onwards
+}
+#endif
@@ -0,0 +1,222 @@
+/*
+ * File:   ctrl.h
+ * Description: Controller decisions: day/night, motion, lamp hold and
+ *              fade, and the run-time configuration they work from
+ * Microcontroller: PIC16F877A
+ */
+
+#ifndef CTRL_H
+#define CTRL_H
+
+#include "hal.h"
+#include "config.h"
+#include "rtc.h"
+#include "io.h"
+
+// The functions here take their inputs as arguments, from the state below
+// or from the io.c inputs, and drive the lamp through Lamp_Set() only, so
+// ctrl.c builds unchanged on the host against sim/hal_host.h (see
+// sim/replay.c).
+
+// Task scheduler: Tasks_Run() runs each task when its period in RTC ticks
+// has elapsed, and at once on a latched input event if it takes them.
+// Tasks must return quickly; nothing in the loop blocks. main() and
+// sim/replay.c build their task tables from these periods and share the
+// bodies below, Ctrl_Input() and Ctrl_Output(), and the interrupt side in
+// Ctrl_Isr(), so a replay runs the firmware's own timing.
+#define TASK_INPUT_MS    20
+#define TASK_LAMP_MS     20
+#define TASK_DISPLAY_MS  150
+#define TASK_LOG_MS      1000
+
+typedef struct
+{
+    unsigned int period;        // RTC ticks between runs
+    unsigned int last;          // ticks at the last run
+    unsigned char on_event;     // also run at once on a latched input event
+    void (*run)(void);
+} task_t;
+
+// After the last motion the lamp holds full for MOTION_HOLD_S, then fades
+// one level per step back to standby over LAMP_FADE_MS. Levels follow the
+// gamma curve, so the fade is linear in perceived brightness.
+#define MOTION_HOLD_S  30
+#define LAMP_FADE_MS   2000
+
+// LAMP_SCHEDULE: the night levels follow sched[] in ctrl.c, a table of
+// (start, standby, on motion) sorted by start time. Sched_Minute() runs
+// from ISR() on each minute rollover and moves on to the next entry when
+// its start comes up, so finding the levels in effect is one compare a
+// minute and an index read in Ctrl_Lamp(). An entry holds until the next
+// one starts, wrapping past midnight. Without it the lamp uses cfg.dim
+// and LAMP_FULL all night.
+#ifndef LAMP_SCHEDULE
+#define LAMP_SCHEDULE  1
+#endif
+
+#define SCHED_AT(h, m)  ((h) * 60 + (m))   // start, minutes after midnight
+#define SCHED_CFG       0xFF                // standby: cfg.dim
+
+typedef struct
+{
+    unsigned int  start;        // SCHED_AT()
+    unsigned char dim;          // night standby level or SCHED_CFG
+    unsigned char boost;        // level on motion and through the hold
+} sched_t;
+
+// SUN_PREDICT (LDR_USE_ADC only): Ctrl_Sun() keeps the times of the last
+// SUN_DAYS sunrises and sunsets since reset and predicts the next of each
+// as their mean; a transition is only learnt once it has lasted
+// SUN_SETTLE_MIN. Within SUN_WINDOW_MIN of a prediction the LDR is sampled
+// every Task_Input pass as before; away from both it is sampled only every
+// SUN_SLOW_MS, and a day/night change there must persist for SUN_CONFIRM_S
+// before it counts, so headlights or a passing cloud are ignored. The
+// history is RAM only: the clock restarts at cfg.start_h after a reset,
+// which would make older times wrong. Until both have a history the
+// windows are open all day.
+#ifndef SUN_PREDICT
+#define SUN_PREDICT     1
+#endif
+#define SUN_DAYS        4       // power of two
+#define SUN_WINDOW_MIN  45
+#define SUN_CONFIRM_S   120
+#define SUN_SLOW_MS     2000
+#define SUN_SETTLE_MIN  60      // a transition must last this long to be learnt
+
+#define SUN_RISE        0       // sun_pred[] index
+#define SUN_SET         1
+
+#define USE_SUN_PREDICT (LDR_USE_ADC && SUN_PREDICT)
+
+#if SUN_DAYS & (SUN_DAYS - 1)
+#error "SUN_DAYS must be a power of two"
+#endif
+
+// Extra zones (ZONE_PINS): zones[] gives each fitted pin its hold time
+// and whether it stands by lit at night. Ctrl_Zones() works on all of them
+// at once as bit masks, zone n being bit n of in_stable and of PORTA, and
+// counts the hold times down once a second.
+typedef struct
+{
+    unsigned char pin;          // one bit of 0x2E
+    unsigned char hold_s;       // lit after the last motion
+    unsigned char standby;      // 1: lit all night
+} zone_t;
+
+// LAMP_WAVE (with UART_TELEMETRY): units are addressed in order along the
+// street. Each motion onset is broadcast and the neighbours up to
+// WAVE_AHEAD poles on in the walker's direction light up from the RX
+// interrupt, ahead of arrival. The sender gives the direction: towards
+// higher addresses if the pole below saw motion within WAVE_DIR_MS, lower
+// if the pole above did, otherwise its two next neighbours light.
+#ifndef LAMP_WAVE
+#define LAMP_WAVE       1
+#endif
+#define WAVE_AHEAD      2
+#define WAVE_DIR_MS     20000
+
+// The CMD_WAVE frame of main.c's protocol, as Wave_Byte() matches it:
+// A5 src B0 01 dir crc
+#define FRAME_SYNC      0xA5
+#define FRAME_REPLY     0x80
+#define CMD_WAVE        0x30
+
+#define WAVE_ANY        0       // Wave_Direction()
+#define WAVE_UP         1
+#define WAVE_DOWN       2
+
+#define DISP_STATUS   0         // cfg.display: status page only
+#define DISP_OFF      1         // panel blanked
+#define DISP_ROTATE   2         // all pages in turn
+
+// cfg_t as packed by Config_Pack(), little endian
+#define CFG_LEN       11
+#define CFG_HOLD_MAX  (32767 / RTC_TICK_HZ)     // seconds, 16-bit ticks
+#define CFG_STREAM_MIN 100      // ms; a status frame takes about 15 at 9600
+
+#if LAMP_WAVE && WAVE_DIR_MS / 1000 > CFG_HOLD_MAX
+#error "WAVE_DIR_MS does not fit the 16-bit tick counter"
+#endif
+#if MOTION_HOLD_S > CFG_HOLD_MAX
+#error "MOTION_HOLD_S does not fit the 16-bit tick counter"
+#endif
+#if USE_SUN_PREDICT && SUN_CONFIRM_S > CFG_HOLD_MAX
+#error "SUN_CONFIRM_S does not fit the 16-bit tick counter"
+#endif
+#if CLOCK_START_H > 23 || LDR_DARK_LEVEL >= LDR_LIGHT_LEVEL
+#error "configuration defaults out of range"
+#endif
+#if TELEM_STREAM_MS && (TELEM_STREAM_MS < CFG_STREAM_MIN || TELEM_STREAM_MS > 65535)
+#error "TELEM_STREAM_MS must be 0 or 100..65535"
+#endif
+
+typedef struct
+{
+    unsigned int  hold_s;       // full brightness after motion
+    unsigned int  fade_ms;      // fade from full to dim
+    unsigned char dim;          // night standby level, below LAMP_FULL
+    unsigned char display;      // DISP_*
+    unsigned char start_h;      // clock at power-up
+    unsigned char dark;         // ambient below this: night (LDR_USE_ADC)
+    unsigned char light;        // ambient above this: day, above dark
+    unsigned int  stream_ms;    // unsolicited status period, 0 = off (main.c)
+} cfg_t;
+
+// Configuration and what Config_Apply() derives from it for Ctrl_Lamp()
+// and the telemetry stream
+extern cfg_t cfg;
+extern unsigned int  hold_ticks;
+extern unsigned int  fade_step_ticks;
+extern unsigned int  stream_ticks;
+
+// Controller state
+extern const unsigned char crc8_table[256];     // CRC-8, poly 0x07
+extern unsigned char isNight;
+extern unsigned char motion;
+extern unsigned long motion_count;     // motion onsets since reset
+extern unsigned char lamp_holding;      // lit full, waiting out hold_ticks
+// Last LDR transitions, restored from the event log at startup
+extern unsigned char sunrise_h, sunrise_m;
+extern unsigned char sunset_h, sunset_m;
+#if USE_SUN_PREDICT
+extern unsigned int  sun_pred[2];       // minutes after midnight
+extern unsigned char sun_near;          // in a window, or no prediction yet
+#endif
+#if LAMP_SCHEDULE
+extern volatile unsigned char sched_cur;    // sched[] entry in effect
+#endif
+#if LAMP_WAVE
+extern volatile unsigned char wave_seen;    // neighbours heard, WAVE_DIR_MS
+#endif
+
+void Tasks_Run(task_t*, unsigned char);
+void Ctrl_Isr(void);
+void Ctrl_Input(void);
+void Ctrl_Output(void);
+void Config_Defaults(void);
+void Config_Apply(void);
+void Config_Pack(unsigned char*);
+unsigned char Config_Unpack(const unsigned char*);
+#if LDR_USE_ADC
+void Ctrl_Ambient(unsigned char, unsigned int);
+#endif
+#if USE_SUN_PREDICT
+unsigned char Ctrl_AdcDue(unsigned int);
+#endif
+#if LAMP_SCHEDULE
+void Sched_Init(unsigned char, unsigned char);
+void Sched_Minute(void);
+#endif
+void Ctrl_Motion(unsigned char);
+void Ctrl_Lamp(unsigned int);
+unsigned char Ctrl_Sun(rtc_snap_t*);
+#if ZONE_PINS
+void Ctrl_Zones(unsigned int);
+#endif
+#if LAMP_WAVE
+unsigned char Wave_Direction(unsigned int);
+void Wave_Rx(unsigned char, unsigned char, unsigned char);
+void Wave_Byte(unsigned char, unsigned char);
+#endif
+
+#endif
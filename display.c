@@ -0,0 +1,232 @@
+/*
+ * File:   display.c
+ * Description: Display pages, see display.h
+ * Microcontroller: PIC16F877A
+ */
+
+#include "display.h"
+
+unsigned char lcd_on = 1;
+unsigned char page = PAGE_STATUS;
+unsigned int  page_at = 0;              // ticks when the page came up
+
+// Uptime as shown, advanced a minute at a time without dividing uptime
+unsigned long up_shown = 0;             // seconds accounted for below
+unsigned char up_m = 0, up_h = 0;
+char up_d[4] = "000";                   // days, ASCII, wraps after 999
+
+// Page texts, packed end to end in ui_text[]. STR_* is the offset of
+// each, the one before plus the sizeof() of its literal, so a text can be
+// edited or added here without recounting.
+#define T_NIGHT      "Night"
+#define T_DAY        "Day"
+#define T_OFF        "OFF"
+#define T_DIM        "DIM"
+#define T_ON         "ON"
+#define T_TIME       "Time"
+#define T_UP         "Up"
+#define T_DAYS       "d"
+#define T_SUNRISE    "Sunrise"
+#define T_SUNSET     "Sunset"
+
+#define STR_NIGHT    0
+#define STR_DAY      (STR_NIGHT   + sizeof(T_NIGHT))
+#define STR_OFF      (STR_DAY     + sizeof(T_DAY))
+#define STR_DIM      (STR_OFF     + sizeof(T_OFF))
+#define STR_ON       (STR_DIM     + sizeof(T_DIM))
+#define STR_TIME     (STR_ON      + sizeof(T_ON))
+#define STR_UP       (STR_TIME    + sizeof(T_TIME))
+#define STR_DAYS     (STR_UP      + sizeof(T_UP))
+#define STR_SUNRISE  (STR_DAYS    + sizeof(T_DAYS))
+#define STR_SUNSET   (STR_SUNRISE + sizeof(T_SUNRISE))
+#define UI_STR(s)    (ui_text + (s))
+
+const char ui_text[] =
+    T_NIGHT "\0"  T_DAY "\0"  T_OFF "\0"  T_DIM "\0"  T_ON "\0"
+    T_TIME "\0"   T_UP "\0"   T_DAYS "\0" T_SUNRISE "\0"  T_SUNSET;
+
+// 5x8 glyphs, GLYPH_SUN onwards
+const unsigned char ui_glyphs[NUM_GLYPHS * 8] =
+{
+    0x04, 0x15, 0x0E, 0x1F, 0x0E, 0x15, 0x04, 0x00,     // sun
+    0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00,     // moon
+    0x0C, 0x0C, 0x00, 0x0E, 0x1C, 0x0C, 0x1A, 0x13,     // walker
+    0x0E, 0x11, 0x11, 0x11, 0x0A, 0x0E, 0x04, 0x00,     // lamp off
+    0x0E, 0x11, 0x11, 0x1F, 0x0E, 0x0E, 0x04, 0x00,     // lamp dim
+    0x0E, 0x1F, 0x1F, 0x1F, 0x0E, 0x0E, 0x04, 0x00,     // lamp on
+};
+
+// Page layouts; together the fields of a page cover all 32 cells
+//  (moon) Night      (walker)
+//  (lamp) DIM
+const lcd_field_t lay_status[] =
+{
+    { LCD_AT(1,1),  2 },        // day / night glyph
+    { LCD_AT(1,3),  13 },       // day / night
+    { LCD_AT(1,16), 1 },        // motion glyph
+    { LCD_AT(2,1),  2 },        // lamp glyph
+    { LCD_AT(2,3),  14 },       // lamp level
+};
+//  Time    22:05:17
+//  Up  012d 03:41
+const lcd_field_t lay_clock[] =
+{
+    { LCD_AT(1,1),  8 },
+    { LCD_AT(1,9),  8 },        // hh:mm:ss
+    { LCD_AT(2,1),  4 },
+    { LCD_AT(2,5),  3 },        // days
+    { LCD_AT(2,8),  2 },
+    { LCD_AT(2,10), 7 },        // hh:mm
+};
+//  Sunrise   06:12
+//  Sunset    19:48
+const lcd_field_t lay_sun[] =
+{
+    { LCD_AT(1,1),  10 },
+    { LCD_AT(1,11), 6 },
+    { LCD_AT(2,1),  10 },
+    { LCD_AT(2,11), 6 },
+};
+
+void Update_Display(unsigned char isNight, unsigned char motion, unsigned char level);
+void Page_Glyph(const lcd_field_t*, unsigned char);
+void Page_Clock(void);
+void Page_Sun(void);
+void Uptime_Advance(void);
+
+// After LCD_Init(), before anything is drawn
+void Display_Init(void)
+{
+    LCD_Glyphs(ui_glyphs, NUM_GLYPHS);
+}
+
+// One display pass: blank or wake the panel, rotate, draw, flush
+void Display_Run(void)
+{
+    unsigned int now;
+
+    if(cfg.display == DISP_OFF)
+    {
+        if(lcd_on) { LCD_Command(0x08); lcd_on = 0; }
+        return;
+    }
+    if(!lcd_on) { LCD_Command(0x0C); lcd_on = 1; }
+
+    now = Ticks_Now();
+    if((unsigned int)(now - page_at) >= TICKS_MS(PAGE_ROTATE_MS))
+    {
+        page_at = now;
+        if(cfg.display != DISP_ROTATE)
+            page = PAGE_STATUS;
+        else if(++page >= NUM_PAGES)
+            page = 0;
+    }
+
+    Uptime_Advance();
+    switch(page)
+    {
+    case PAGE_CLOCK: Page_Clock(); break;
+    case PAGE_SUN:   Page_Sun();   break;
+    default:         Update_Display(isNight, motion, brightness); break;
+    }
+    LCD_Flush();
+}
+
+// ================= PAGES =================
+void Update_Display(unsigned char isNight, unsigned char motion, unsigned char level)
+{
+    Page_Glyph(&lay_status[0], isNight ? GLYPH_MOON : GLYPH_SUN);
+    LCD_Field(&lay_status[1], UI_STR(isNight ? STR_NIGHT : STR_DAY));
+    Page_Glyph(&lay_status[2], motion ? GLYPH_MOTION : ' ');
+
+    if(level == 0)
+    {
+        Page_Glyph(&lay_status[3], GLYPH_LAMP_OFF);
+        LCD_Field(&lay_status[4], UI_STR(STR_OFF));
+    }
+    else if(level == LAMP_FULL)
+    {
+        Page_Glyph(&lay_status[3], GLYPH_LAMP_ON);
+        LCD_Field(&lay_status[4], UI_STR(STR_ON));
+    }
+    else
+    {
+        Page_Glyph(&lay_status[3], GLYPH_LAMP_DIM);
+        LCD_Field(&lay_status[4], UI_STR(STR_DIM));
+    }
+}
+
+// One glyph code (or blank) as a field
+void Page_Glyph(const lcd_field_t* f, unsigned char g)
+{
+    char s[2];
+
+    s[0] = g;
+    s[1] = 0;
+    LCD_Field(f, s);
+}
+
+void Page_Clock(void)
+{
+    char t[9] = "00:00:00";
+    rtc_snap_t now;
+
+    RTC_Snapshot(&now);
+
+    Fmt_2(t, now.hours);
+    Fmt_2(t + 3, now.minutes);
+    Fmt_2(t + 6, now.seconds);
+    LCD_Field(&lay_clock[0], UI_STR(STR_TIME));
+    LCD_Field(&lay_clock[1], t);
+
+    Fmt_2(t, up_h);
+    Fmt_2(t + 3, up_m);
+    t[5] = 0;
+    LCD_Field(&lay_clock[2], UI_STR(STR_UP));
+    LCD_Field(&lay_clock[3], up_d);
+    LCD_Field(&lay_clock[4], UI_STR(STR_DAYS));
+    LCD_Field(&lay_clock[5], t);
+}
+
+void Page_Sun(void)
+{
+    char t[6] = "00:00";
+
+    Fmt_2(t, sunrise_h);
+    Fmt_2(t + 3, sunrise_m);
+    LCD_Field(&lay_sun[0], UI_STR(STR_SUNRISE));
+    LCD_Field(&lay_sun[1], t);
+
+    Fmt_2(t, sunset_h);
+    Fmt_2(t + 3, sunset_m);
+    LCD_Field(&lay_sun[2], UI_STR(STR_SUNSET));
+    LCD_Field(&lay_sun[3], t);
+}
+
+// Bring a page up now, for one rotation period
+void Page_Show(unsigned char p)
+{
+    page = p;
+    page_at = Ticks_Now();
+}
+
+// Called every display pass, so the loop rarely runs more than once
+void Uptime_Advance(void)
+{
+    rtc_snap_t now;
+    unsigned char i;
+
+    RTC_Snapshot(&now);
+
+    while(now.uptime - up_shown >= 60)
+    {
+        up_shown += 60;
+        if(++up_m < 60) continue;
+        up_m = 0;
+        if(++up_h < 24) continue;
+        up_h = 0;
+        i = 3;
+        while(i-- && ++up_d[i] > '9')   // ASCII carry
+            up_d[i] = '0';
+    }
+}
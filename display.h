@@ -0,0 +1,41 @@
+/*
+ * File:   display.h
+ * Description: Display pages of the full controller, drawn into the LCD
+ *              framebuffer
+ * Microcontroller: PIC16F877A
+ */
+
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include "hal.h"
+#include "config.h"
+#include "lcd.h"
+#include "ctrl.h"
+
+// Display pages. Every page writes all 32 cells into the framebuffer and
+// LCD_Flush() sends only those that changed, so a clock tick costs the
+// seconds digits alone. With cfg.display == DISP_ROTATE the pages take
+// turns every PAGE_ROTATE_MS; a sunrise or sunset brings up PAGE_SUN for
+// one period in either mode. Texts come from the packed ui_text[] and
+// positions from a field table per page, both const and so in flash.
+#define PAGE_STATUS     0       // day/night, motion, lamp
+#define PAGE_CLOCK      1       // time of day, uptime
+#define PAGE_SUN        2       // last sunrise and sunset
+#define NUM_PAGES       3
+#define PAGE_ROTATE_MS  4000
+
+// CGRAM glyphs loaded by Display_Init(), codes for LCD_Field() texts
+#define GLYPH_SUN       1
+#define GLYPH_MOON      2
+#define GLYPH_MOTION    3
+#define GLYPH_LAMP_OFF  4
+#define GLYPH_LAMP_DIM  5
+#define GLYPH_LAMP_ON   6
+#define NUM_GLYPHS      6
+
+void Display_Init(void);
+void Display_Run(void);
+void Page_Show(unsigned char);
+
+#endif
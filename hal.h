@@ -0,0 +1,21 @@
+/*
+ * File:   hal.h
+ * Description: Register access for the shared modules: the XC8 device
+ *              header on the target, sim/hal_host.h in a host build
+ * Microcontroller: PIC16F877A
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+// lcd.c, rtc.c, io.c, ctrl.c and display.c reach the hardware only through
+// the SFR names and delay macros of <xc.h>. Built with -DHAL_HOST they get
+// plain variables and no-op delays instead, so the same sources compile
+// natively for sim/replay.c; the application files stay target only.
+#ifdef HAL_HOST
+#include "sim/hal_host.h"
+#else
+#include <xc.h>
+#endif
+
+#endif
@@ -0,0 +1,326 @@
+/*
+ * File:   io.c
+ * Description: Board I/O, see io.h
+ * Microcontroller: PIC16F877A
+ */
+
+#include "io.h"
+
+#if INPUT_USE_IRQ
+volatile unsigned char input_events = 0;
+volatile unsigned char ldr_state = 0;
+volatile unsigned char pir_state = 0;
+#endif
+#if MOTION_STAMP
+volatile unsigned int  motion_stamp = 0;
+#endif
+
+#if INPUT_DEBOUNCE
+volatile unsigned char in_stable = 0;
+unsigned char in_ct0 = 0xFF, in_ct1 = 0xFF;     // counter bit 0 and 1 of each input
+#endif
+
+#if LDR_USE_ADC
+unsigned int  adc_acc = 0;              // sum of the current block
+unsigned char adc_count = 0;
+unsigned int  ldr_iir = 0;              // 12-bit level << LDR_IIR_SHIFT
+unsigned char ldr_seeded = 0;
+volatile unsigned char ambient = 255;
+#endif
+
+volatile unsigned char brightness = 0;
+
+#if ENERGY_STATS
+energy_t en;
+unsigned char en_lit = 0;               // lamp lit at the last second
+#if LAMP_USE_PWM
+unsigned int  en_frac = 0;              // duty counts short of a full second
+#endif
+#endif
+#if ZONE_PINS
+unsigned char zone_lit = 0;
+#endif
+
+#if LAMP_USE_PWM
+// Lamp level -> CCP2 duty. Gamma 2.2 so equal steps look equally bright;
+// entries are per mille of full duty, scaled to PR2 at compile time.
+#define DUTY(pm) ((unsigned int)((pm) * (unsigned long)PWM_DUTY_MAX / 1000))
+const unsigned int lamp_curve[LAMP_LEVELS] =
+{
+    DUTY(0),   DUTY(3),   DUTY(12),  DUTY(29),
+    DUTY(55),  DUTY(89),  DUTY(133), DUTY(187),
+    DUTY(251), DUTY(325), DUTY(410), DUTY(505),
+    DUTY(612), DUTY(730), DUTY(859), DUTY(1000),
+};
+#endif
+
+void Port_Init(void);
+#if INPUT_DEBOUNCE
+unsigned char IO_Sample(void);
+#endif
+#if LAMP_USE_PWM
+void PWM_Init(void);
+#endif
+#if LDR_USE_ADC
+void ADC_Init(void);
+#endif
+
+// Pins, lamp output, LDR converter and the input interrupts. The
+// application sets PEIE/GIE once all modules are up.
+void IO_Init(void)
+{
+    Port_Init();
+#if LAMP_USE_PWM
+    PWM_Init();
+#endif
+#if LDR_USE_ADC
+    ADC_Init();
+#endif
+
+#if INPUT_DEBOUNCE
+    in_stable = IO_Sample();    // start settled, no edges at power-up
+#endif
+#if LDR_USE_INT
+    ldr_state = LDR_LEVEL;
+    OPTION_REGbits.INTEDG = !LDR_IN;
+    INTCONbits.INTF = 0;
+    INTCONbits.INTE = 1;
+#endif
+#if INPUT_USE_IRQ && PIR_ON_RB4
+    pir_state = (PORTB & 0x10) ? 1 : 0;
+    INTCONbits.RBIF = 0;
+    INTCONbits.RBIE = 1;
+#endif
+}
+
+void Port_Init(void)
+{
+#if LDR_USE_ADC
+    TRISAbits.TRISA0 = 1;   // LDR, AN0
+#else
+    TRISBbits.TRISB0 = 1;   // LDR
+#endif
+#if PIR_ON_RB4
+    TRISBbits.TRISB4 = 1;   // PIR
+    TRISD = 0x00;           // LCD
+#else
+    TRISD = 0x04;           // RD2 = PIR, others LCD
+#endif
+    TRISCbits.TRISC1 = 0;   // LED
+
+    PORTCbits.RC1 = 0;
+    PORTD = 0x00;
+
+    OPTION_REGbits.nRBPU = 0;
+
+#if ZONE_PINS
+#if !LDR_USE_ADC
+    ADCON1 = 0x06;          // PORTA digital
+#endif
+    PORTA &= ~ZONE_PINS;
+    TRISA &= ~ZONE_PINS;    // zone lamps
+    TRISB |= ZONE_PINS;     // zone PIRs
+#endif
+}
+
+#if LAMP_USE_PWM
+// CCP2 PWM on RC1, period = Timer2 (PR2 = RTC_T2_PR2, prescaler RTC_T2_PRE)
+void PWM_Init(void)
+{
+    CCPR2L = 0;
+    CCP2CON = 0x0C;             // PWM mode, duty LSBs = 0
+}
+#endif
+
+#if LDR_USE_ADC
+// A/D clock: the fastest Fosc divider that keeps Tad at 1.6 us or more
+#if _XTAL_FREQ <= 1250000UL
+#define ADC_ADCS  0x00          // Fosc/2
+#elif _XTAL_FREQ <= 5000000UL
+#define ADC_ADCS  0x40          // Fosc/8
+#else
+#define ADC_ADCS  0x80          // Fosc/32, Tad 1.6 us at 20 MHz
+#endif
+
+// AN0 only, 10-bit right justified result, completion on ADIF
+void ADC_Init(void)
+{
+    ADCON1 = 0x8E;              // right justified, AN0 analog, rest digital
+    ADCON0 = ADC_ADCS | 0x01;   // AN0, on
+    PIR1bits.ADIF = 0;
+    PIE1bits.ADIE = 1;
+}
+#endif
+
+// Called from ISR(): LDR edge, PIR change, LDR conversion
+void IO_Isr(void)
+{
+#if LDR_USE_INT
+    if(INTCONbits.INTF)                     // raw LDR edge: a wake-up only
+    {
+        INTCONbits.INTF = 0;
+        OPTION_REGbits.INTEDG = !LDR_IN;    // wait for the opposite edge
+    }
+#endif
+
+#if INPUT_USE_IRQ && PIR_ON_RB4
+    if(INTCONbits.RBIF)                     // PIR change on RB4
+    {
+        unsigned char pir = PORTB & 0x10;   // reading PORTB ends the mismatch
+        INTCONbits.RBIF = 0;
+
+        motion_stamp = ticks;               // either edge: motion until now
+        if(pir && !pir_state)
+        {
+            input_events |= EVT_MOTION;
+            if(ldr_state) Lamp_Set(LAMP_FULL);  // night: lamp on now
+        }
+        pir_state = pir ? 1 : 0;
+    }
+#endif
+
+#if LDR_USE_ADC
+    if(PIR1bits.ADIF)                       // LDR conversion done
+    {
+        PIR1bits.ADIF = 0;
+        adc_acc += ((unsigned int)ADRESH << 8) | ADRESL;
+
+        if(++adc_count >= (1 << LDR_OVERSAMPLE_SHIFT))
+        {
+            unsigned int x = adc_acc >> (LDR_OVERSAMPLE_SHIFT - 2);
+
+            if(ldr_seeded)
+                ldr_iir += x - (ldr_iir >> LDR_IIR_SHIFT);
+            else
+            {
+                ldr_iir = x << LDR_IIR_SHIFT;   // start from the first block
+                ldr_seeded = 1;
+            }
+            ambient = (unsigned char)(ldr_iir >> (LDR_IIR_SHIFT + 4));
+
+            adc_acc = 0;
+            adc_count = 0;
+        }
+    }
+#endif
+}
+
+// Also called from IO_Isr() for the immediate on/off on input edges
+void Lamp_Set(unsigned char level)
+{
+#if LAMP_USE_PWM
+    unsigned int duty;
+#endif
+
+    if(level > LAMP_FULL) level = LAMP_FULL;    // lamp_curve[] and en.on[] index
+#if LAMP_USE_PWM
+    duty = lamp_curve[level];
+
+    CCPR2L = (unsigned char)(duty >> 2);
+    CCP2CONbits.CCP2X = (duty >> 1) & 1;
+    CCP2CONbits.CCP2Y = duty & 1;
+#else
+    PORTCbits.RC1 = level ? 1 : 0;
+#endif
+    brightness = level;
+}
+
+#if ZONE_PINS
+// Zone lamps on the PORTA bits matching their PIRs, all in one write
+void Zone_Set(unsigned char lit)
+{
+    zone_lit = lit & ZONE_PINS;
+    PORTA = (PORTA & ~ZONE_PINS) | zone_lit;
+}
+#endif
+
+#if INPUT_DEBOUNCE
+// The polled pins, at their IN_* positions in one byte
+unsigned char IO_Sample(void)
+{
+    unsigned char s = 0;
+
+#if PIR_ON_RB4
+#define IN_PORTB (IN_POLLED & (IN_LDR | IN_PIR | ZONE_PINS))
+#else
+#define IN_PORTB (IN_POLLED & (IN_LDR | ZONE_PINS))
+#endif
+#if IN_PORTB
+    s = PORTB;
+#if INPUT_USE_IRQ && PIR_ON_RB4
+    if(((s & IN_PIR) ? 1 : 0) != pir_state)
+        INTCONbits.RBIF = 1;            // for IO_Isr(), next in ISR()
+#endif
+    s &= IN_PORTB;
+#endif
+#if !PIR_ON_RB4 && (IN_POLLED & IN_PIR)
+    if(PORTDbits.RD2) s |= IN_PIR;
+#endif
+    return s;
+}
+
+// Each bit's counter runs 3, 2, 1, 0 while the pin differs from in_stable
+// and reloads to 3 when it agrees; the step past 0 flips the bit.
+void IO_Tick(void)
+{
+    unsigned char d = IO_Sample() ^ in_stable;
+
+    in_ct0 = ~(in_ct0 & d);
+    in_ct1 = in_ct0 ^ (in_ct1 & d);
+    d &= in_ct0 & in_ct1;               // counters that wrapped
+
+    in_stable ^= d;
+#if INPUT_USE_IRQ
+#if !LDR_USE_ADC
+    if(d & IN_LDR)                      // settled LDR change
+    {
+        input_events |= EVT_LDR;
+        if(!(in_stable & IN_LDR))       // daylight: lamp off now
+        {
+            ldr_state = 0;
+            Lamp_Set(0);
+        }
+    }
+#endif
+    if(in_stable & IN_PIR)              // settled PIR high: motion now
+        motion_stamp = ticks;
+    if(d & in_stable & IN_PIR)          // settled PIR rising edge
+        input_events |= EVT_MOTION;
+#endif
+}
+#endif
+
+#if ENERGY_STATS
+// Once a second from ISR(): increments and one compare, nothing wider
+void Energy_Second(void)
+{
+    unsigned char level = brightness;
+
+    if(!level)
+    {
+        en_lit = 0;
+        return;
+    }
+    if(!en_lit) en.switch_on++;
+    en_lit = 1;
+
+    en.on[level >> ENERGY_BAND_SHIFT]++;
+#if LAMP_USE_PWM
+    en_frac += lamp_curve[level];       // at most PWM_DUTY_MAX a second
+    if(en_frac >= PWM_DUTY_MAX)
+    {
+        en_frac -= PWM_DUTY_MAX;
+        en.energy++;
+    }
+#else
+    en.energy++;
+#endif
+}
+
+void Energy_Snapshot(energy_t* e)
+{
+    INTCONbits.GIE = 0;
+    *e = en;
+    INTCONbits.GIE = 1;
+}
+#endif
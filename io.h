@@ -0,0 +1,156 @@
+/*
+ * File:   io.h
+ * Description: Board I/O: LDR and PIR inputs with their interrupts, the
+ *              LDR ADC filter and the lamp output
+ * Microcontroller: PIC16F877A
+ */
+
+#ifndef IO_H
+#define IO_H
+
+#include "hal.h"
+#include "config.h"
+#include "rtc.h"
+
+#define LDR_IN PORTBbits.RB0
+#if PIR_ON_RB4
+#define PIR_IN PORTBbits.RB4
+#else
+#define PIR_IN PORTDbits.RD2
+#endif
+
+#if LDR_USE_ADC
+#define LDR_USE_INT 0
+#else
+#define LDR_USE_INT INPUT_USE_IRQ   // RB0/INT edges wake SLEEP, see below
+#endif
+
+// INPUT_DEBOUNCE: IO_Tick() samples the polled pins together as one byte
+// on every RTC tick and runs a 2-bit vertical counter per bit, so all of
+// them debounce in parallel in about ten instructions. A pin must read
+// differently from in_stable for 4 ticks running (32 ms at 125 Hz) before
+// its bit flips. The tasks read LDR_LEVEL and PIR_LEVEL; with
+// INPUT_USE_IRQ a settled PIR rising edge also raises EVT_MOTION, and a
+// settled LDR change raises EVT_LDR, turning the lamp off at once if it
+// is daylight. The digital LDR is always debounced here: RB0/INT only
+// wakes SLEEP, it decides nothing. A PIR on RB4
+// interrupt-on-change keeps its ISR path; IO_Tick() runs in ISR() just
+// before IO_Isr(), and if a change fell on its PORTB read and set no
+// flag, it sets RBIF itself. PORTB bits keep their place in the byte, so
+// the zone PIRs (ZONE_PINS) are in it as read; RD2 moves up to the unused
+// RB6 position.
+#define IN_LDR  0x01            // RB0
+#if PIR_ON_RB4
+#define IN_PIR  0x10            // RB4
+#else
+#define IN_PIR  0x40            // RD2
+#endif
+
+#define IN_POLLED ((LDR_USE_ADC ? 0 : IN_LDR) | \
+                   ((INPUT_USE_IRQ && PIR_ON_RB4) ? 0 : IN_PIR) | ZONE_PINS)
+
+#if INPUT_DEBOUNCE && RTC_USE_TIMER1
+#error "INPUT_DEBOUNCE needs the Timer2 RTC tick"
+#endif
+#if ZONE_PINS & ~0x2E
+#error "ZONE_PINS: zones exist on bits 1, 2, 3 and 5 only"
+#endif
+#if ZONE_PINS && (!INPUT_DEBOUNCE || (INPUT_USE_IRQ && PIR_ON_RB4))
+#error "ZONE_PINS needs INPUT_DEBOUNCE and PORTB free of the RB4 interrupt"
+#endif
+
+// Input levels as the tasks should see them
+#if INPUT_DEBOUNCE
+#define LDR_LEVEL  ((in_stable & IN_LDR) ? 1 : 0)
+#define PIR_LEVEL  ((in_stable & IN_PIR) ? 1 : 0)
+#else
+#define LDR_LEVEL  LDR_IN
+#define PIR_LEVEL  PIR_IN
+#endif
+
+#define EVT_LDR     0x01        // LDR changed state, debounced
+#define EVT_MOTION  0x02        // PIR rising edge
+
+// MOTION_STAMP: motion_stamp holds the RTC ticks at the last motion the
+// ISR saw, on every tick the debounced PIR is high or at each RB4 edge,
+// so Ctrl_Lamp() times the hold from the event rather than from the task
+// pass that noticed it. A polled PIR without INPUT_DEBOUNCE has no stamp.
+#define MOTION_STAMP (INPUT_USE_IRQ && (PIR_ON_RB4 || INPUT_DEBOUNCE))
+
+// Lamp levels 0 (off) .. LAMP_FULL. With LAMP_USE_PWM each one maps to a
+// 10-bit CCP2 duty from lamp_curve[]; the PWM period is one Timer2 period
+// before the postscaler (1.25 kHz at 20 MHz, 1 kHz at 4 MHz).
+#define LAMP_LEVELS   16
+#define LAMP_FULL     (LAMP_LEVELS - 1)
+#define PWM_DUTY_MAX  (4 * (RTC_T2_PR2 + 1))    // 100 % duty count
+
+#define PWM_HZ        (_XTAL_FREQ / 4 / (RTC_T2_PRE * (RTC_T2_PR2 + 1)))
+
+#if LAMP_USE_PWM && PWM_HZ < 100
+#error "lamp PWM below 100 Hz flickers: raise RTC_T2_HZ"
+#endif
+#if LAMP_USE_PWM && PWM_DUTY_MAX < 4 * LAMP_LEVELS
+#error "too few PWM duty steps at this _XTAL_FREQ for the lamp curve"
+#endif
+#if LAMP_DIM >= LAMP_FULL
+#error "LAMP_DIM must be below LAMP_FULL"
+#endif
+#if LDR_OVERSAMPLE_SHIFT < 2 || LDR_OVERSAMPLE_SHIFT > 6
+#error "LDR_OVERSAMPLE_SHIFT must be 2..6 to fit the 16-bit accumulator"
+#endif
+
+#if INPUT_USE_IRQ
+// Input state latched by IO_Isr(); main() takes input_events with GIE masked
+extern volatile unsigned char input_events;
+extern volatile unsigned char ldr_state;    // isNight, for the PIR interrupt
+extern volatile unsigned char pir_state;
+#endif
+#if MOTION_STAMP
+extern volatile unsigned int  motion_stamp; // ticks at the last motion seen
+#endif
+
+#if INPUT_DEBOUNCE
+extern volatile unsigned char in_stable;    // debounced IN_* levels
+#endif
+
+#if LDR_USE_ADC
+// LDR pipeline, owned by IO_Isr(); main() only reads these
+extern unsigned char ldr_seeded;
+extern volatile unsigned char ambient;      // filtered level, 8 bits
+#endif
+
+extern volatile unsigned char brightness;   // lamp level, 0 .. LAMP_FULL; ISR() sets it too
+#if ZONE_PINS
+extern unsigned char zone_lit;              // ZONE_PINS lamps on
+#endif
+#if LAMP_USE_PWM
+extern const unsigned int lamp_curve[LAMP_LEVELS];
+#endif
+
+#if ENERGY_STATS
+// Lamp counters, owned by Energy_Second(); read them with Energy_Snapshot()
+#define ENERGY_BANDS  (LAMP_LEVELS >> ENERGY_BAND_SHIFT)
+
+typedef struct
+{
+    unsigned long on[ENERGY_BANDS];     // lit seconds, levels 1 << shift per band
+    unsigned long energy;               // full-power equivalent seconds
+    unsigned long switch_on;            // off -> lit, sampled each second
+} energy_t;
+#endif
+
+void IO_Init(void);
+void IO_Isr(void);
+void Lamp_Set(unsigned char);
+#if ENERGY_STATS
+void Energy_Second(void);       // from ISR() on RTC_EVT_SECOND
+void Energy_Snapshot(energy_t*);
+#endif
+#if ZONE_PINS
+void Zone_Set(unsigned char);
+#endif
+#if INPUT_DEBOUNCE
+void IO_Tick(void);             // from ISR() on RTC_EVT_TICK
+#endif
+
+#endif
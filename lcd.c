@@ -0,0 +1,297 @@
+/*
+ * File:   lcd.c
+ * Description: HD44780 LCD driver, see lcd.h
+ * Microcontroller: PIC16F877A
+ */
+
+#include "lcd.h"
+
+// LCD framebuffer: what the panel should show, plus one dirty bit per
+// cell (bit 0 = column 1) for cells not yet sent by LCD_Flush()
+unsigned char lcd_fb[LCD_ROWS][LCD_COLS];
+unsigned int  lcd_dirty[LCD_ROWS];
+
+#if ENERGY_STATS || defined(HAL_HOST)
+unsigned long lcd_bytes = 0;
+#endif
+
+#if LCD_USE_QUEUE
+// LCD output queue: DDRAM address + character per entry. main() advances
+// head, the ISR advances tail.
+unsigned char lcdq_addr[LCDQ_SIZE];
+unsigned char lcdq_char[LCDQ_SIZE];
+volatile unsigned char lcdq_head = 0;
+volatile unsigned char lcdq_tail = 0;
+unsigned char lcdq_byte;                // byte being clocked out
+unsigned char lcdq_phase = 0;           // 1 = low nibble still to send
+unsigned char lcdq_cursor = 0xFF;       // panel DDRAM address, 0xFF = unknown
+#endif
+
+void LCD_Nibble(unsigned char);
+void LCD_Write(unsigned char, unsigned char);
+#if LCD_RW_WIRED
+void LCD_WaitBusy(void);
+#endif
+#if LCD_USE_QUEUE
+void Timer0_Init(void);
+unsigned char LCD_Enqueue(unsigned char, unsigned char);
+#endif
+
+// ================= LCD FUNCTIONS =================
+void LCD_Init(void)
+{
+#if LCD_USE_QUEUE
+    Timer0_Init();
+#endif
+    __delay_ms(20);
+    LCD_Command(0x02);
+    LCD_Command(0x28);
+    LCD_Command(0x0C);
+    LCD_Command(0x06);
+    LCD_Command(0x01);
+}
+
+void LCD_Nibble(unsigned char nib)
+{
+    LCD_D4 = nib & 1;
+    LCD_D5 = (nib >> 1) & 1;
+    LCD_D6 = (nib >> 2) & 1;
+    LCD_D7 = (nib >> 3) & 1;
+
+    LCD_EN = 1; LCD_EN_WAIT(); LCD_EN = 0;
+}
+
+#if LCD_RW_WIRED
+void LCD_WaitBusy(void)
+{
+    unsigned char busy;
+
+    TRISD |= 0xF0;          // RD4-RD7 input while reading
+    LCD_RS = 0;
+    LCD_RW = 1;
+
+    do
+    {
+        LCD_EN = 1; LCD_EN_WAIT();
+        busy = LCD_D7;      // BF is D7 of the high nibble
+        LCD_EN = 0;
+
+        LCD_EN = 1; LCD_EN_WAIT(); LCD_EN = 0;   // low nibble, unused
+    } while(busy);
+
+    LCD_RW = 0;
+    TRISD &= 0x0F;
+}
+#endif
+
+void LCD_Write(unsigned char val, unsigned char rs)
+{
+#if LCD_USE_QUEUE
+    LCD_Sync();                 // never share the bus with the ISR
+    lcdq_cursor = 0xFF;
+#endif
+#if LCD_RW_WIRED
+    LCD_WaitBusy();
+#endif
+#if ENERGY_STATS || defined(HAL_HOST)
+    lcd_bytes++;
+#endif
+    LCD_RS = rs;
+    LCD_Nibble(val >> 4);
+    LCD_Nibble(val);
+}
+
+void LCD_Command(unsigned char cmd)
+{
+    LCD_Write(cmd, 0);
+#if !LCD_RW_WIRED
+    if(cmd <= 0x03) __delay_us(LCD_T_HOME_US);   // clear / return home
+    else            LCD_EXEC_WAIT();
+#endif
+}
+
+void LCD_Data(unsigned char dat)
+{
+    LCD_Write(dat, 1);
+#if !LCD_RW_WIRED
+    LCD_EXEC_WAIT();
+#endif
+}
+
+void LCD_String(const char* str)
+{
+    while(*str) LCD_Data(*str++);
+}
+
+void LCD_Clear(void)
+{
+    unsigned char r, c;
+
+    LCD_Command(0x01);
+
+    for(r = 0; r < LCD_ROWS; r++)
+    {
+        for(c = 0; c < LCD_COLS; c++) lcd_fb[r][c] = ' ';
+        lcd_dirty[r] = 0;
+    }
+}
+
+// Load n glyphs into CGRAM codes 1..n; the panel then writes DDRAM again
+void LCD_Glyphs(const unsigned char* rows, unsigned char n)
+{
+    unsigned char i;
+
+    if(n > LCD_GLYPHS_MAX) n = LCD_GLYPHS_MAX;
+    LCD_Command(0x40 | 8);              // CGRAM, code 1
+    for(i = 0; i < n * 8; i++) LCD_Data(rows[i] & 0x1F);
+    LCD_Command(0x80);
+}
+
+void LCD_SetCursor(unsigned char row, unsigned char col)
+{
+    LCD_Command((row == 1 ? 0x80 : 0xC0) + col - 1);
+}
+
+// ================= LCD FRAMEBUFFER =================
+// Draw into the framebuffer; only cells whose character changes are marked
+void LCD_Put(unsigned char row, unsigned char col, const char* str)
+{
+    unsigned char *cell = &lcd_fb[row - 1][col - 1];
+    unsigned int bit = 1u << (col - 1);
+
+    while(*str && bit)      // bit shifts out past the last column
+    {
+        if(*cell != *str)
+        {
+            *cell = *str;
+            lcd_dirty[row - 1] |= bit;
+        }
+        cell++; str++; bit <<= 1;
+    }
+}
+
+// Draw a field, blank-padded to its width
+void LCD_Field(const lcd_field_t* f, const char* str)
+{
+    unsigned char row = f->at >> 4, col = f->at & 0x0F;
+    unsigned char *cell = &lcd_fb[row][col];
+    unsigned int bit = 1u << col;
+    unsigned char n = f->width, ch;
+
+    while(n-- && bit)
+    {
+        ch = *str ? *str++ : ' ';
+        if(*cell != ch)
+        {
+            *cell = ch;
+            lcd_dirty[row] |= bit;
+        }
+        cell++; bit <<= 1;
+    }
+}
+
+// Send the dirty cells, one cursor move + burst write per run
+void LCD_Flush(void)
+{
+    unsigned char r, c;
+    unsigned int dirty, bit;
+
+    for(r = 0; r < LCD_ROWS; r++)
+    {
+        dirty = lcd_dirty[r];
+
+        for(c = 0, bit = 1; dirty; c++, bit <<= 1)
+        {
+            if(!(dirty & bit)) continue;
+
+#if LCD_USE_QUEUE
+            // the ISR merges consecutive addresses into one cursor move;
+            // when the queue is full the rest waits for the next flush
+            if(!LCD_Enqueue((r ? 0x40 : 0x00) + c, lcd_fb[r][c])) break;
+            dirty &= ~bit;
+#else
+            LCD_SetCursor(r + 1, c + 1);
+            while(dirty & bit)
+            {
+                LCD_Data(lcd_fb[r][c]);
+                dirty &= ~bit;
+                c++; bit <<= 1;
+            }
+#endif
+        }
+
+        lcd_dirty[r] = dirty;
+    }
+}
+
+#if LCD_USE_QUEUE
+// ================= LCD QUEUE =================
+// Timer0 paces the queue; TMR0IE is only set while the queue has work
+void Timer0_Init(void)
+{
+    OPTION_REGbits.T0CS = 0;    // Fosc/4
+#if SUPERVISED
+    OPTION_REGbits.PSA  = 1;    // prescaler on the WDT -> 256 Tcy per overflow
+#else
+    OPTION_REGbits.PSA  = 0;    // prescaler on Timer0
+    OPTION_REGbits.PS   = 0;    // 1:2 -> 512 Tcy per overflow
+#endif
+    TMR0 = 0;
+}
+
+unsigned char LCD_Enqueue(unsigned char addr, unsigned char ch)
+{
+    unsigned char next = (lcdq_head + 1) & LCDQ_MASK;
+
+    if(next == lcdq_tail) return 0;     // full
+
+    lcdq_addr[lcdq_head] = addr;
+    lcdq_char[lcdq_head] = ch;
+    lcdq_head = next;
+    INTCONbits.TMR0IE = 1;
+    return 1;
+}
+
+// Called from ISR() on each Timer0 overflow: one nibble per tick
+void LCD_QueueTick(void)
+{
+    if(lcdq_phase)
+    {
+        LCD_Nibble(lcdq_byte);
+        lcdq_phase = 0;
+        return;
+    }
+
+    if(lcdq_tail == lcdq_head)
+    {
+        INTCONbits.TMR0IE = 0;          // idle until the next LCD_Enqueue()
+        return;
+    }
+
+    if(lcdq_addr[lcdq_tail] != lcdq_cursor)
+    {
+        lcdq_cursor = lcdq_addr[lcdq_tail];
+        lcdq_byte = 0x80 | lcdq_cursor; // set DDRAM address
+        LCD_RS = 0;
+    }
+    else
+    {
+        lcdq_byte = lcdq_char[lcdq_tail];
+        lcdq_tail = (lcdq_tail + 1) & LCDQ_MASK;
+        lcdq_cursor++;
+        LCD_RS = 1;
+    }
+
+#if ENERGY_STATS || defined(HAL_HOST)
+    lcd_bytes++;
+#endif
+    LCD_Nibble(lcdq_byte >> 4);
+    lcdq_phase = 1;
+}
+
+// Wait until the ISR has sent everything queued
+void LCD_Sync(void)
+{
+    while(INTCONbits.TMR0IE);
+}
+#endif
@@ -0,0 +1,86 @@
+/*
+ * File:   lcd.h
+ * Description: HD44780 16x2 LCD in 4-bit mode, with a framebuffer and an
+ *              optional Timer0-driven output queue
+ * Microcontroller: PIC16F877A
+ */
+
+#ifndef LCD_H
+#define LCD_H
+
+#include "hal.h"
+#include "config.h"
+
+// LCD Pin Definitions
+#define LCD_RS RD0
+#define LCD_EN RD3
+#define LCD_D4 RD4
+#define LCD_D5 RD5
+#define LCD_D6 RD6
+#define LCD_D7 RD7
+#define LCD_RW RD1              // only with LCD_RW_WIRED
+
+#define LCD_T_EXEC_US  40      // instruction / character write (37 us)
+#define LCD_T_HOME_US  1520    // clear display, return home
+
+// Waits shorter than one instruction cycle (4 us at 1 MHz, 122 us at
+// 32 kHz) are already covered by the code around them
+#if _XTAL_FREQ >= 4000000UL
+#define LCD_EN_WAIT()   __delay_us(1)
+#else
+#define LCD_EN_WAIT()   ((void)0)
+#endif
+#if 4000000UL / _XTAL_FREQ < LCD_T_EXEC_US
+#define LCD_EXEC_WAIT() __delay_us(LCD_T_EXEC_US)
+#else
+#define LCD_EXEC_WAIT() ((void)0)
+#endif
+
+#if LCD_USE_QUEUE && _XTAL_FREQ < 1000000UL
+#error "LCD_USE_QUEUE: Timer0 ticks of 256+ Tcy are too slow below 1 MHz"
+#endif
+#if LCD_USE_QUEUE && SUPERVISED && 1024000000UL / _XTAL_FREQ < LCD_T_EXEC_US
+#error "256 Tcy Timer0 ticks are shorter than LCD_T_EXEC_US at this _XTAL_FREQ"
+#endif
+
+#define LCD_ROWS 2
+#define LCD_COLS 16
+
+#define LCDQ_SIZE 32            // power of two
+#define LCDQ_MASK (LCDQ_SIZE - 1)
+
+// Framebuffer fields: a cell address and a width. Pages are laid out as
+// tables of fields, and LCD_Field() pads its text out to the width, so no
+// literal needs trailing blanks.
+#define LCD_AT(row, col)  ((((row) - 1) << 4) | ((col) - 1))
+
+typedef struct
+{
+    unsigned char at;           // LCD_AT()
+    unsigned char width;        // cells, text is left-aligned
+} lcd_field_t;
+
+// Custom characters: LCD_Glyphs() loads CGRAM codes 1..n from 8 rows of
+// 5 bits each; code 0 is left alone so every glyph can sit in a string
+#define LCD_GLYPHS_MAX  7
+
+#if ENERGY_STATS || defined(HAL_HOST)
+extern unsigned long lcd_bytes;  // bytes sent to the panel, also counted by the queue ISR
+#endif
+
+void LCD_Init(void);
+void LCD_Command(unsigned char);
+void LCD_Data(unsigned char);
+void LCD_String(const char*);
+void LCD_Clear(void);
+void LCD_SetCursor(unsigned char, unsigned char);
+void LCD_Put(unsigned char, unsigned char, const char*);
+void LCD_Field(const lcd_field_t*, const char*);
+void LCD_Glyphs(const unsigned char*, unsigned char);
+void LCD_Flush(void);
+#if LCD_USE_QUEUE
+void LCD_QueueTick(void);       // from ISR() on TMR0IF while TMR0IE is set
+void LCD_Sync(void);
+#endif
+
+#endif
@@ -5,234 +5,1101 @@
  */
 
 #include <xc.h>
+#include "config.h"
+#include "lcd.h"
+#include "rtc.h"
+#include "io.h"
+#include "ctrl.h"
+#include "display.h"
+#include "prof.h"
 
 // CONFIGURATION BITS
+#if CLOCK_PROFILE == CLOCK_32KHZ
+#pragma config FOSC = LP
+#elif CLOCK_PROFILE == CLOCK_4MHZ
+#pragma config FOSC = XT
+#else
 #pragma config FOSC = HS
+#endif
+#if SUPERVISED
+#pragma config WDTE = ON
+#pragma config PWRTE = ON
+#pragma config BOREN = ON
+#else
 #pragma config WDTE = OFF
 #pragma config PWRTE = ON
 #pragma config BOREN = OFF
+#endif
 #pragma config LVP = OFF
 #pragma config CPD = OFF
 #pragma config WRT = OFF
 #pragma config CP = OFF
 
-#define _XTAL_FREQ 20000000
+#if defined(VARIANT_INTENSITY) || defined(VARIANT_EXTRA)
+#error "main.c is the full controller: build it without a VARIANT_ define"
+#endif
+
+// Task scheduler: see Tasks_Run() in ctrl.h for the periods and the shared
+// task bodies. main() adds the log, UART and telemetry tasks.
+//
+// SUPERVISED: each task body checks in with TASK_DONE() as it finishes.
+// After every pass Tasks_OnTime() turns the check-ins into stamps and
+// clears them, and the WDT is cleared only if no task has gone more than
+// WDT_LATE_MS past its period without one, so a task that hangs or stops
+// finishing, or an interrupt storm that starves the loop, ends in a reset. Reset_Cause() reads PCON and STATUS at startup. After a
+// WDT, MCLR or brown-out reset the clock, day/night and lamp level come
+// back from warm, a __persistent copy that Task_Log() refreshes every
+// second (startup code leaves it alone, its CRC tells it from power-up
+// garbage). The lamp is set again before the LCD is touched and the
+// splash is skipped, so it is back within milliseconds. A power-on reset
+// or a bad CRC starts cold. Under LOW_POWER a WDT timeout only wakes
+// SLEEP early, and the pass that follows clears it.
+#define WDT_LATE_MS      200
+
+#define TASK_ID_INPUT    0      // tasks[] positions, bits of task_in
+#define TASK_ID_LAMP     1
+#define TASK_ID_DISPLAY  2
+#define TASK_ID_LOG      3
+#define TASK_ID_UART     4
+#define TASK_ID_TELEM    5
+#if SUPERVISED
+#define TASK_DONE(id)    (task_in |= 1 << (id))
+#else
+#define TASK_DONE(id)    ((void)0)
+#endif
+
+#define RESET_POR        0      // Reset_Cause()
+#define RESET_BOR        1
+#define RESET_WDT        2
+#define RESET_MCLR       3
+
+// UART telemetry on RC6/RC7, 8N1. The ISR fills and drains the rings,
+// senders never wait on TXIF. With UART_RS485 the transceiver's DE line
+// on RC5 is raised for each transmission and dropped once the shift
+// register is empty; /RE is tied to DE, so a unit never hears itself.
+//
+// Several units share one bus and a gateway polls them in turn:
+//   frame: A5 addr type len payload[len] crc
+// crc is CRC-8 (poly 0x07, init 0) over addr..payload. A request carries
+// the unit address, its reply the same type | FRAME_REPLY and the
+// responder's own address. Frames to ADDR_BROADCAST are acted on but never
+// answered, so they cannot collide. A nonzero cfg.stream_ms (config.h's
+// TELEM_STREAM_MS by default) sends unsolicited status frames at that
+// period instead, for a point-to-point link only.
+// A unit in LOW_POWER sleep cannot receive, so such units should stream.
+// CLOCK_32KHZ has no usable baud rate and builds without the UART.
+//
+// LAMP_WAVE units also announce each motion onset with a CMD_WAVE reply
+// frame from their own address, once no request is coming in. Task_Uart()
+// drops it like any reply; Wave_Byte(), fed from ISR(), checks it as it
+// arrives and hands it to Wave_Rx(), so a neighbour lights within a byte
+// time of the CRC. The gateway must leave gaps between polls for these
+// frames; one that collides fails its CRC and is lost.
+#define UART_TELEMETRY   (CLOCK_PROFILE != CLOCK_32KHZ)
+#define UART_BAUD        9600
+#define UART_RS485       1
+#define RS485_DE         PORTCbits.RC5
+#define FRAME_GAP_MS     20     // silence that abandons a partial frame
+
+#define UART_TX_SIZE     32     // powers of two
+#define UART_RX_SIZE     16
+#define UART_TX_MASK     (UART_TX_SIZE - 1)
+#define UART_RX_MASK     (UART_RX_SIZE - 1)
+
+#define FRAME_MAX_RX     (CFG_LEN + 1)  // longest request payload we accept
+
+#define CMD_STATUS       0x01   // -> state, levels, motion count, uptime
+#define CMD_READ_ALL     0x02   // -> every counter and timestamp at once
+#define CMD_SET_ADDR     0x10   // new address, 1..0xFE; stored in EEPROM
+#define CMD_GET_CONFIG   0x11   // -> CFG_VERSION, cfg fields
+#define CMD_SET_CONFIG   0x12   // CFG_VERSION, cfg fields -> 1 stored, 0 refused
+#define CMD_GET_PROFILE  0x20   // [1 = then reset] -> min, max, avg per region (PROFILE)
+#define CMD_GET_ENERGY   0x21   // page -> page, counters (ENERGY_STATS), see Send_Energy()
+// CMD_WAVE 0x30, sent as a reply: dir of a motion onset (LAMP_WAVE); it,
+// FRAME_SYNC and FRAME_REPLY are in ctrl.h for the Wave_Byte() matcher
+
+#if PROFILE && 6 * PROF_REGIONS + 5 > UART_TX_SIZE - 1
+#error "UART_TX_SIZE cannot hold the profile frame"
+#endif
+#if ENERGY_STATS && 4 * ENERGY_BANDS + 5 + 5 > UART_TX_SIZE - 1
+#error "UART_TX_SIZE cannot hold energy page 0: raise ENERGY_BAND_SHIFT"
+#endif
+
+#define USE_WAVE         (UART_TELEMETRY && LAMP_WAVE)
+
+#define ADDR_BROADCAST   0xFF
+#define ADDR_DEFAULT     0x01   // used while EE_UNIT_ADDR is blank
+
+// BRGH = 1: SPBRG = Fosc / (16 * baud) - 1, rounded
+#define UART_SPBRG  ((_XTAL_FREQ + 8UL * UART_BAUD) / (16UL * UART_BAUD) - 1)
+#define UART_REAL   (_XTAL_FREQ / (16UL * (UART_SPBRG + 1)))
+
+#if UART_TELEMETRY
+#if UART_SPBRG > 255
+#error "UART_BAUD too low for BRGH = 1 at this _XTAL_FREQ"
+#endif
+#if UART_REAL * 100 > UART_BAUD * 102UL || UART_REAL * 100 < UART_BAUD * 98UL
+#error "UART_BAUD is more than 2 % off at this _XTAL_FREQ"
+#endif
+#endif
 
-// LCD Pin Definitions
-#define LCD_RS RD0
-#define LCD_EN RD3
-#define LCD_D4 RD4
-#define LCD_D5 RD5
-#define LCD_D6 RD6
-#define LCD_D7 RD7
+// Event log in data EEPROM: LOG_SLOTS 4-byte records used as a ring, so
+// every slot takes the same share of the writes. Each record carries an
+// 8-bit sequence number; Log_Init() finds the newest one by binary search.
+//   byte 0: type(3) hour(5)   byte 1: minute(6) day bits 9-8
+//   byte 2: day bits 7-0      byte 3: sequence, written last
+// LOG_ENERGY records (ENERGY_STATS) close each hour instead:
+//   byte 0: type(3) hour(5)   byte 1: lamp energy / 16 s
+//   byte 2: motion onsets, 255 at most   byte 3: sequence
+// hour is the one that ended; energy is in full-power seconds. With one
+// a hour the ring holds about two days of them.
+// Writes go through eeq[] and are issued one byte per EEIF interrupt.
+// 0xC0-0xFF hold the configuration block and, in the last byte, the
+// unit address.
+#define LOG_BASE      0x00
+#define LOG_SLOTS     48
+#define LOG_REC_SIZE  4
 
-// Global Variables
-volatile unsigned char seconds = 0;
-volatile unsigned char minutes = 0;
-volatile unsigned char hours   = 22;
+#define LOG_BOOT      1
+#define LOG_SUNSET    2
+#define LOG_SUNRISE   3
+#define LOG_WARM      4         // warm restart (SUPERVISED)
+#define LOG_ENERGY    5         // hourly totals (ENERGY_STATS)
+#define LOG_EMPTY     7         // type field of an erased slot
+
+#define EEQ_SIZE      16        // power of two, at least 4 records' worth
+#define EEQ_MASK      (EEQ_SIZE - 1)
+
+#if LOG_BASE + LOG_SLOTS * LOG_REC_SIZE > 0xC0
+#error "event log does not fit below the configuration area"
+#endif
+
+#define EE_UNIT_ADDR  0xFF
+
+// Run-time configuration. The ctrl.h defines are the defaults; the working
+// copy is cfg, loaded once by Config_Load() and changed over the UART.
+// Block at CFG_BASE:
+//   byte 0: CFG_VERSION     bytes 1..CFG_LEN: cfg_t fields, little endian
+//   last:   CRC-8 over the bytes before it
+// A blank, torn or other-version block fails the check and the defaults
+// apply. Bump CFG_VERSION whenever the field layout changes.
+#define CFG_BASE      0xC0
+#define CFG_VERSION   2
+#define CFG_EE_SIZE   (CFG_LEN + 2)
+
+#if CFG_BASE + CFG_EE_SIZE > EE_UNIT_ADDR
+#error "configuration block overlaps the unit address"
+#endif
+#if CFG_EE_SIZE > EEQ_SIZE - 1
+#error "EEQ_SIZE cannot queue the configuration block"
+#endif
+
+#if SUPERVISED
+// Retained across resets other than power-on, see Warm_Save()
+typedef struct
+{
+    unsigned char hours, minutes, seconds;
+    unsigned char isNight;
+    unsigned char level;        // brightness
+    unsigned char check;        // CRC-8 of the bytes above
+} warm_t;
+#endif
 
 // Function Prototypes
 void System_Init(void);
-void Port_Init(void);
-void Timer2_Init(void);
+#if SUPERVISED
+unsigned char Reset_Cause(void);
+unsigned char Tasks_OnTime(void);
+unsigned char Warm_Check(void);
+void Warm_Save(const rtc_snap_t*);
+unsigned char Warm_Restore(void);
+#endif
+#if LOW_POWER
+void Sleep_Idle(void);
+#endif
 void Interrupt_Init(void);
-void LCD_Init(void);
-void LCD_Command(unsigned char);
-void LCD_Data(unsigned char);
-void LCD_String(const char*);
-void LCD_Clear(void);
-void LCD_SetCursor(unsigned char, unsigned char);
-void Update_Display(unsigned char isNight, unsigned char motion, unsigned char level);
+unsigned char EE_Read(unsigned char);
+unsigned char EE_Write(unsigned char, unsigned char);
+void EE_Start(void);
+void Log_Init(void);
+void Log_Event(unsigned char, const rtc_snap_t*);
+void Log_Record(unsigned char, unsigned char, unsigned char, unsigned char);
+#if ENERGY_STATS
+void Energy_Hour(const rtc_snap_t*);
+#endif
+void Config_Load(void);
+unsigned char Config_Save(void);
+void Task_Input(void);
+void Task_Lamp(void);
+void Task_Display(void);
+void Task_Log(void);
+#if UART_TELEMETRY
+void UART_Init(void);
+unsigned char UART_Getc(unsigned char*);
+unsigned char Frame_Send(unsigned char, const unsigned char*, unsigned char);
+void Frame_Handle(unsigned char);
+void Send_Status(void);
+void Send_All(void);
+#if ENERGY_STATS
+void Send_Energy(unsigned char);
+void Pack_32(unsigned char*, unsigned long);
+#endif
+void Task_Uart(void);
+void Task_Telemetry(void);
+#endif
+
+// EEPROM write queue: main() advances head, the EEIF interrupt tail
+unsigned char eeq_addr[EEQ_SIZE];
+unsigned char eeq_data[EEQ_SIZE];
+volatile unsigned char eeq_head = 0;
+volatile unsigned char eeq_tail = 0;
+volatile unsigned char ee_busy = 0;     // a write is in progress
+unsigned char log_slot = 0;             // next slot to write
+unsigned char log_seq = 0;              // its sequence number
+
+#if ENERGY_STATS
+// Hourly totals for LOG_ENERGY and Send_Energy()
+unsigned char en_hour = 0xFF;           // hour being counted, 0xFF = none yet
+unsigned long en_energy_at;             // counters when it began
+unsigned long en_motion_at;
+unsigned int  en_last_energy = 0;       // the last full hour, seconds
+unsigned int  en_last_motion = 0;
+#endif
+
+#if UART_TELEMETRY
+// UART rings: the producer owns head, the consumer owns tail
+unsigned char uart_tx_buf[UART_TX_SIZE];
+unsigned char uart_rx_buf[UART_RX_SIZE];
+volatile unsigned char uart_tx_head = 0, uart_tx_tail = 0;
+volatile unsigned char uart_rx_head = 0, uart_rx_tail = 0;
+
+// Request parser, fed from the RX ring by Task_Uart()
+#define RX_SYNC  0
+#define RX_ADDR  1
+#define RX_TYPE  2
+#define RX_LEN   3
+#define RX_DATA  4
+#define RX_CRC   5
+unsigned char rx_state = RX_SYNC;
+unsigned char rx_addr, rx_type, rx_len, rx_pos, rx_crc;
+unsigned char rx_data[FRAME_MAX_RX];
+unsigned int  rx_last = 0;              // ticks at the last byte
+unsigned int  stream_at = 0;            // ticks at the last status stream
+unsigned char unit_addr = ADDR_DEFAULT;
+#endif
+
+#if USE_WAVE
+unsigned long wave_sent = 0;            // motion_count last announced
+#endif
+
+task_t tasks[] =
+{
+    { TICKS_MS(TASK_INPUT_MS),   0, 1, Task_Input   },
+    { TICKS_MS(TASK_LAMP_MS),    0, 1, Task_Lamp    },
+    { TICKS_MS(TASK_DISPLAY_MS), 0, 0, Task_Display },
+    { TICKS_MS(TASK_LOG_MS),     0, 0, Task_Log     },
+#if UART_TELEMETRY
+    { 0,                         0, 0, Task_Uart    },  // every pass
+    { 0,                         0, 0, Task_Telemetry },  // times itself
+#endif
+};
+#define NUM_TASKS (sizeof(tasks) / sizeof(tasks[0]))
+
+#if HIL_PROBES
+unsigned char probe_e;                  // PORTE latch copy, see PROBE_SET()
+#endif
+
+#if SUPERVISED
+__persistent warm_t warm;
+unsigned char reset_cause;              // RESET_*
+unsigned char warm_start = 0;           // state came back from warm
+unsigned char task_in = 0;              // TASK_DONE() since the last pass
+unsigned int  task_done[NUM_TASKS];     // ticks at each task's last one
+#endif
 
 // ================= INTERRUPT =================
 void __interrupt() ISR(void)
 {
-    if(PIR1bits.TMR2IF)
+    PROBE_ISR(1);
+    PROF_BEGIN(PROF_ISR);
+#if PROFILE
+    if(PIR1bits.TMR2IF && PIE1bits.TMR2IE)
+        PROF_ADD(PROF_LAT, (unsigned int)TMR2 * RTC_T2_PRE);   // TMR2 restarts at the match
+#endif
+    Ctrl_Isr();
+
+#if UART_TELEMETRY
+    if(PIR1bits.RCIF)                       // byte received
     {
-        PIR1bits.TMR2IF = 0;
-        seconds++;
+        unsigned char next = (uart_rx_head + 1) & UART_RX_MASK;
+        unsigned char c = RCREG;
+
+        if(RCSTAbits.OERR)                  // overrun: restart the receiver
+        {
+            RCSTAbits.CREN = 0;
+            RCSTAbits.CREN = 1;
+        }
+        if(next != uart_rx_tail)            // drop the byte when full
+        {
+            uart_rx_buf[uart_rx_head] = c;
+            uart_rx_head = next;
+        }
+#if USE_WAVE
+        Wave_Byte(c, unit_addr);
+#endif
+    }
 
-        if(seconds >= 60)
+    if(PIE1bits.TXIE && PIR1bits.TXIF)      // TXREG empty
+    {
+        if(uart_tx_tail != uart_tx_head)
         {
-            seconds = 0;
-            minutes++;
-            if(minutes >= 60)
-            {
-                minutes = 0;
-                hours++;
-                if(hours >= 24) hours = 0;
-            }
+            TXREG = uart_tx_buf[uart_tx_tail];
+            uart_tx_tail = (uart_tx_tail + 1) & UART_TX_MASK;
         }
+        else
+            PIE1bits.TXIE = 0;              // Task_Uart drops DE after TRMT
+    }
+#endif
+
+    if(PIR2bits.EEIF)                       // EEPROM byte written
+    {
+        PIR2bits.EEIF = 0;
+        if(eeq_tail != eeq_head) EE_Start();
+        else                     ee_busy = 0;
+    }
+
+#if LCD_USE_QUEUE
+    if(INTCONbits.TMR0IF && INTCONbits.TMR0IE)
+    {
+        INTCONbits.TMR0IF = 0;
+        LCD_QueueTick();
     }
+#endif
+    PROF_END(PROF_ISR);
+    PROBE_ISR(0);
 }
 
 // ================= MAIN =================
 void main(void)
 {
-    unsigned char isNight;
-    unsigned char motion;
-    unsigned char brightness; // 0=OFF, 2=FULL
+    unsigned char i;
+    rtc_snap_t boot;
 
+#if SUPERVISED
+    reset_cause = Reset_Cause();
+#endif
     System_Init();
     LCD_Clear();
 
-    LCD_String("Street Light");
-    LCD_SetCursor(2,1);
-    LCD_String("Controller");
-    __delay_ms(2000);
-    LCD_Clear();
+#if SUPERVISED
+    if(!warm_start)
+#endif
+    {
+        LCD_String("Street Light");
+        LCD_SetCursor(2,1);
+        LCD_String("Controller");
+        for(i = 0; i < 20; i++)
+        {
+            CLRWDT();
+            __delay_ms(100);
+        }
+        LCD_Clear();
+    }
+
+    RTC_Snapshot(&boot);
+#if SUPERVISED
+    Log_Event(warm_start ? LOG_WARM : LOG_BOOT, &boot);
+#else
+    Log_Event(LOG_BOOT, &boot);
+#endif
 
     while(1)
     {
-        isNight = PORTBbits.RB0;   // LDR
-        motion  = PORTDbits.RD2;   // PIR
+        PROF_LAP(PROF_LOOP);
+        PROBE_LOOP();
+        Tasks_Run(tasks, NUM_TASKS);
 
-        // ? DAY
-        if(isNight == 0)
-        {
-            PORTCbits.RC1 = 0;
-            brightness = 0;
-        }
-        // ? NIGHT
-        else
-        {
-            if(motion)
-            {
-                PORTCbits.RC1 = 1;   // LED ON
-                brightness = 2;
-            }
-            else
-            {
-                PORTCbits.RC1 = 0;   // LED OFF
-                brightness = 0;
-            }
-        }
+#if SUPERVISED
+        if(Tasks_OnTime()) CLRWDT();
+#endif
+#if LOW_POWER
+        Sleep_Idle();
+#endif
+    }
+}
+
+// ================= TASKS =================
+// Ctrl_Input(), then the motion broadcast (LAMP_WAVE)
+void Task_Input(void)
+{
+    Ctrl_Input();
+#if USE_WAVE
+    if(motion_count != wave_sent && rx_state == RX_SYNC)
+    {
+        unsigned char dir = Wave_Direction(Ticks_Now());
+
+        if(Frame_Send(CMD_WAVE | FRAME_REPLY, &dir, 1)) wave_sent = motion_count;
+    }
+#endif
+    TASK_DONE(TASK_ID_INPUT);
+}
+
+void Task_Lamp(void)
+{
+    Ctrl_Output();
+    TASK_DONE(TASK_ID_LAMP);
+}
+
+void Task_Display(void)
+{
+    PROBE_DISP(1);
+    PROF_BEGIN(PROF_FLUSH);
+    Display_Run();
+    PROF_END(PROF_FLUSH);
+    PROBE_DISP(0);
+    TASK_DONE(TASK_ID_DISPLAY);
+}
+
+// Sunrise / sunset: log every settled LDR transition
+void Task_Log(void)
+{
+    rtc_snap_t t;
+    unsigned char sun = Ctrl_Sun(&t);
 
-        Update_Display(isNight, motion, brightness);
-        __delay_ms(150);
+#if SUPERVISED
+    Warm_Save(&t);
+#endif
+#if ENERGY_STATS
+    if(t.hours != en_hour) Energy_Hour(&t);
+#endif
+    if(sun)
+    {
+        Log_Event(isNight ? LOG_SUNSET : LOG_SUNRISE, &t);
+        Page_Show(PAGE_SUN);
     }
+    TASK_DONE(TASK_ID_LOG);
 }
 
 // ================= INITIALIZATION =================
 void System_Init(void)
 {
-    Port_Init();
-    Timer2_Init();
+    IO_Init();
+    RTC_Init();
+    PROBE_INIT();
+#if SUPERVISED
+    warm_start = Warm_Restore();        // lamp first, before anything slow
+#endif
+#if PROFILE
+    Prof_Init();
+#endif
+    Config_Load();
+#if SUPERVISED
+    if(!warm_start)
+#endif
+        hours = cfg.start_h;
+#if LAMP_SCHEDULE
+    Sched_Init(hours, minutes);
+#endif
+    Log_Init();
+#if UART_TELEMETRY
+    UART_Init();
+#endif
     Interrupt_Init();
     LCD_Init();
+    Display_Init();
+}
+
+// IO_Init() and RTC_Init() have enabled their own sources
+void Interrupt_Init(void)
+{
+    PIR2bits.EEIF = 0;
+    PIE2bits.EEIE = 1;
+    INTCONbits.PEIE = 1;
+    INTCONbits.GIE  = 1;
 }
 
-void Port_Init(void)
+#if SUPERVISED
+// ================= SUPERVISOR =================
+// Call first thing in main(); re-arms the PCON flags for the next reset
+unsigned char Reset_Cause(void)
 {
-    TRISBbits.TRISB0 = 1;   // LDR
-    TRISCbits.TRISC1 = 0;   // LED
-    TRISD = 0x04;           // RD2 = PIR, others LCD
+    unsigned char cause;
 
-    PORTCbits.RC1 = 0;
-    PORTD = 0x00;
+    if(!PCONbits.nPOR)       cause = RESET_POR;   // nBOR is unknown then
+    else if(!PCONbits.nBOR)  cause = RESET_BOR;
+    else if(!STATUSbits.nTO) cause = RESET_WDT;
+    else                     cause = RESET_MCLR;
 
-    OPTION_REGbits.nRBPU = 0;
+    PCONbits.nPOR = 1;
+    PCONbits.nBOR = 1;
+    return cause;
 }
 
-void Timer2_Init(void)
+// After a scheduler pass: nonzero if every task has checked in in time
+unsigned char Tasks_OnTime(void)
 {
-    T2CON = 0x00;
-    TMR2  = 0;
-    PR2   = 249;
+    unsigned int now = Ticks_Now();
+    unsigned char i, ok = 1;
 
-    T2CONbits.T2CKPS0 = 1;
-    T2CONbits.T2CKPS1 = 1;
-    T2CONbits.TMR2ON = 1;
+    for(i = 0; i < NUM_TASKS; i++)
+    {
+        if(task_in & (1 << i))
+            task_done[i] = now;
+        else if((unsigned int)(now - task_done[i]) >= tasks[i].period + TICKS_MS(WDT_LATE_MS))
+            ok = 0;
+    }
+    task_in = 0;
+    return ok;
 }
 
-void Interrupt_Init(void)
+// CRC-8 of warm up to its check byte
+unsigned char Warm_Check(void)
 {
-    INTCON = 0x00;
-    PIE1bits.TMR2IE = 1;
-    INTCONbits.PEIE = 1;
-    INTCONbits.GIE  = 1;
+    const unsigned char* p = (const unsigned char*)&warm;
+    unsigned char crc = 0, i;
+
+    for(i = 0; i < sizeof(warm) - 1; i++)
+        crc = crc8_table[crc ^ p[i]];
+    return crc;
 }
 
-// ================= LCD FUNCTIONS =================
-void LCD_Init(void)
+// From Task_Log(), once a second
+void Warm_Save(const rtc_snap_t* t)
 {
-    __delay_ms(20);
-    LCD_Command(0x02);
-    LCD_Command(0x28);
-    LCD_Command(0x0C);
-    LCD_Command(0x06);
-    LCD_Command(0x01);
-    __delay_ms(2);
+    warm.hours   = t->hours;
+    warm.minutes = t->minutes;
+    warm.seconds = t->seconds;
+    warm.isNight = isNight;
+    warm.level   = brightness;
+    warm.check   = Warm_Check();
 }
 
-void LCD_Command(unsigned char cmd)
+// After IO_Init() and RTC_Init(), before interrupts are on; nonzero when
+// the state was restored
+unsigned char Warm_Restore(void)
 {
-    LCD_RS = 0;
+    if(reset_cause == RESET_POR || warm.check != Warm_Check()
+       || warm.hours > 23 || warm.minutes > 59 || warm.seconds > 59
+       || warm.level > LAMP_FULL)
+        return 0;
 
-    LCD_D4 = (cmd >> 4) & 1;
-    LCD_D5 = (cmd >> 5) & 1;
-    LCD_D6 = (cmd >> 6) & 1;
-    LCD_D7 = (cmd >> 7) & 1;
+    isNight = warm.isNight;
+    Lamp_Set(warm.level);
+    hours   = warm.hours;
+    minutes = warm.minutes;
+    seconds = warm.seconds;
+    return 1;
+}
+#endif
 
-    LCD_EN = 1; __delay_us(1); LCD_EN = 0;
+#if LOW_POWER
+// ================= LOW POWER =================
+// SLEEP until the next enabled interrupt. GIE is masked around the check
+// so an event that lands just before SLEEP makes it fall straight through
+// instead of being serviced and then slept on; ISR() runs once GIE is back.
+void Sleep_Idle(void)
+{
+#if LCD_USE_QUEUE
+    LCD_Sync();                 // Timer0 stops in SLEEP
+#endif
+#if LAMP_USE_PWM
+    if(brightness != 0 && brightness != LAMP_FULL)
+        return;                 // Timer2 stops in SLEEP: no dimmed output
+#endif
+#if LDR_USE_ADC
+    while(ADCON0bits.GO_nDONE); // SLEEP would abort the conversion
+#endif
+#if UART_TELEMETRY
+    if(PIE1bits.TXIE || !TXSTAbits.TRMT)
+        return;                 // still transmitting
+#endif
+    INTCONbits.GIE = 0;
+    if(!input_events) SLEEP();
+    NOP();
+    INTCONbits.GIE = 1;
+}
+#endif
 
-    LCD_D4 = cmd & 1;
-    LCD_D5 = (cmd >> 1) & 1;
-    LCD_D6 = (cmd >> 2) & 1;
-    LCD_D7 = (cmd >> 3) & 1;
+#if UART_TELEMETRY
+// ================= UART =================
+void UART_Init(void)
+{
+    TRISCbits.TRISC6 = 1;       // TX, driven by the USART
+    TRISCbits.TRISC7 = 1;       // RX
+#if UART_RS485
+    TRISCbits.TRISC5 = 0;       // RS-485 DE
+    RS485_DE = 0;
+#endif
+    SPBRG = UART_SPBRG;
+    TXSTA = 0x24;               // TXEN, async, BRGH
+    RCSTA = 0x90;               // SPEN, CREN
+    PIE1bits.RCIE = 1;
 
-    LCD_EN = 1; __delay_us(1); LCD_EN = 0;
-    __delay_ms(2);
+    unit_addr = EE_Read(EE_UNIT_ADDR);
+    if(unit_addr == 0 || unit_addr == ADDR_BROADCAST)
+        unit_addr = ADDR_DEFAULT;
 }
 
-void LCD_Data(unsigned char dat)
+unsigned char UART_Getc(unsigned char* c)
 {
-    LCD_RS = 1;
+    if(uart_rx_tail == uart_rx_head) return 0;
+
+    *c = uart_rx_buf[uart_rx_tail];
+    uart_rx_tail = (uart_rx_tail + 1) & UART_RX_MASK;
+    return 1;
+}
 
-    LCD_D4 = (dat >> 4) & 1;
-    LCD_D5 = (dat >> 5) & 1;
-    LCD_D6 = (dat >> 6) & 1;
-    LCD_D7 = (dat >> 7) & 1;
+// Queue a whole frame or nothing; never waits for the transmitter
+unsigned char Frame_Send(unsigned char type, const unsigned char* p, unsigned char n)
+{
+    unsigned char head = uart_tx_head;
+    unsigned char crc = 0, b, i;
 
-    LCD_EN = 1; __delay_us(1); LCD_EN = 0;
+    if(((uart_tx_tail - head - 1) & UART_TX_MASK) < n + 5) return 0;
 
-    LCD_D4 = dat & 1;
-    LCD_D5 = (dat >> 1) & 1;
-    LCD_D6 = (dat >> 2) & 1;
-    LCD_D7 = (dat >> 3) & 1;
+    uart_tx_buf[head] = FRAME_SYNC;
+    head = (head + 1) & UART_TX_MASK;
+    for(i = 0; i < n + 3; i++)
+    {
+        if(i == 0)      b = unit_addr;
+        else if(i == 1) b = type;
+        else if(i == 2) b = n;
+        else            b = p[i - 3];
+        crc = crc8_table[crc ^ b];
+        uart_tx_buf[head] = b;
+        head = (head + 1) & UART_TX_MASK;
+    }
+    uart_tx_buf[head] = crc;
+    uart_tx_head = (head + 1) & UART_TX_MASK;
 
-    LCD_EN = 1; __delay_us(1); LCD_EN = 0;
-    __delay_ms(2);
+#if UART_RS485
+    RS485_DE = 1;
+#endif
+    PIE1bits.TXIE = 1;
+    return 1;
 }
 
-void LCD_String(const char* str)
+// Parse requests from the RX ring and release the RS-485 bus once the
+// last stop bit is out
+void Task_Uart(void)
 {
-    while(*str) LCD_Data(*str++);
+    unsigned char c;
+    unsigned int now = Ticks_Now();
+
+    if(rx_state != RX_SYNC && (unsigned int)(now - rx_last) > TICKS_MS(FRAME_GAP_MS))
+        rx_state = RX_SYNC;
+
+    while(UART_Getc(&c))
+    {
+        rx_last = now;
+        switch(rx_state)
+        {
+        case RX_SYNC:
+            if(c == FRAME_SYNC) { rx_crc = 0; rx_state = RX_ADDR; }
+            break;
+        case RX_ADDR:
+            rx_addr = c;
+            rx_crc = crc8_table[rx_crc ^ c];
+            rx_state = RX_TYPE;
+            break;
+        case RX_TYPE:
+            rx_type = c;
+            rx_crc = crc8_table[rx_crc ^ c];
+            rx_state = RX_LEN;
+            break;
+        case RX_LEN:
+            rx_len = c;
+            rx_pos = 0;
+            rx_crc = crc8_table[rx_crc ^ c];
+            rx_state = c > FRAME_MAX_RX ? RX_SYNC : c ? RX_DATA : RX_CRC;
+            break;
+        case RX_DATA:
+            rx_data[rx_pos++] = c;
+            rx_crc = crc8_table[rx_crc ^ c];
+            if(rx_pos == rx_len) rx_state = RX_CRC;
+            break;
+        default:
+            rx_state = RX_SYNC;
+            if(c != rx_crc || (rx_type & FRAME_REPLY)) break;    // bad, or another unit's reply
+            if(rx_addr == unit_addr)
+                Frame_Handle(1);
+            else if(rx_addr == ADDR_BROADCAST)
+                Frame_Handle(0);
+            break;
+        }
+    }
+
+#if UART_RS485
+    if(RS485_DE && !PIE1bits.TXIE && TXSTAbits.TRMT)
+        RS485_DE = 0;
+#endif
+    TASK_DONE(TASK_ID_UART);
+}
+
+// One verified request in rx_type/rx_data; answer only when addressed
+void Frame_Handle(unsigned char reply)
+{
+    unsigned char ok;
+
+    switch(rx_type)
+    {
+    case CMD_STATUS:
+        if(reply) Send_Status();
+        break;
+    case CMD_READ_ALL:
+        if(reply) Send_All();
+        break;
+    case CMD_SET_ADDR:
+        if(!reply || rx_len != 1 || rx_data[0] == 0 || rx_data[0] == ADDR_BROADCAST)
+            break;
+        if(!EE_Write(EE_UNIT_ADDR, rx_data[0]))
+            break;
+        unit_addr = rx_data[0];
+        Frame_Send(CMD_SET_ADDR | FRAME_REPLY, &unit_addr, 1);    // from the new address
+        break;
+    case CMD_GET_CONFIG:
+        if(!reply) break;
+        rx_data[0] = CFG_VERSION;
+        Config_Pack(rx_data + 1);
+        Frame_Send(CMD_GET_CONFIG | FRAME_REPLY, rx_data, CFG_LEN + 1);
+        break;
+    case CMD_SET_CONFIG:
+        ok = 0;
+        if(rx_len == CFG_LEN + 1 && rx_data[0] == CFG_VERSION
+           && ((eeq_tail - eeq_head - 1) & EEQ_MASK) >= CFG_EE_SIZE     // room to store it
+           && Config_Unpack(rx_data + 1))
+            ok = Config_Save();
+        if(reply) Frame_Send(CMD_SET_CONFIG | FRAME_REPLY, &ok, 1);
+        break;
+#if ENERGY_STATS
+    case CMD_GET_ENERGY:
+        if(reply && rx_len == 1) Send_Energy(rx_data[0]);
+        break;
+#endif
+#if PROFILE
+    case CMD_GET_PROFILE:
+        if(reply)
+        {
+            unsigned char f[6 * PROF_REGIONS];
+
+            Prof_Read(f);
+            Frame_Send(CMD_GET_PROFILE | FRAME_REPLY, f, sizeof(f));
+        }
+        if(rx_len == 1 && rx_data[0] == 1) Prof_Reset();
+        break;
+#endif
+    }
+}
+
+// Status: state, lamp level, light level, motion count, uptime
+void Send_Status(void)
+{
+    unsigned char f[9];
+    rtc_snap_t t;
+
+    RTC_Snapshot(&t);
+
+    f[0] = (isNight ? 0x01 : 0) | (motion ? 0x02 : 0) | (lamp_holding ? 0x04 : 0);
+    f[1] = brightness;
+#if LDR_USE_ADC
+    f[2] = ambient;
+#else
+    f[2] = isNight ? 0x00 : 0xFF;
+#endif
+    f[3] = (unsigned char)motion_count;
+    f[4] = (unsigned char)(motion_count >> 8);
+    f[5] = (unsigned char)t.uptime;
+    f[6] = (unsigned char)(t.uptime >> 8);
+    f[7] = (unsigned char)(t.uptime >> 16);
+    f[8] = (unsigned char)(t.uptime >> 24);
+
+    Frame_Send(CMD_STATUS | FRAME_REPLY, f, sizeof(f));
+}
+
+// Everything a gateway wants from one poll: the status fields followed
+// by the clock, day count, last sunset/sunrise and log position
+void Send_All(void)
+{
+    unsigned char f[19];
+    rtc_snap_t t;
+
+    RTC_Snapshot(&t);
+
+    f[0]  = (isNight ? 0x01 : 0) | (motion ? 0x02 : 0) | (lamp_holding ? 0x04 : 0);
+    f[1]  = brightness;
+#if LDR_USE_ADC
+    f[2]  = ambient;
+#else
+    f[2]  = isNight ? 0x00 : 0xFF;
+#endif
+    f[3]  = (unsigned char)motion_count;
+    f[4]  = (unsigned char)(motion_count >> 8);
+    f[5]  = (unsigned char)t.uptime;
+    f[6]  = (unsigned char)(t.uptime >> 8);
+    f[7]  = (unsigned char)(t.uptime >> 16);
+    f[8]  = (unsigned char)(t.uptime >> 24);
+    f[9]  = t.hours;
+    f[10] = t.minutes;
+    f[11] = t.seconds;
+    f[12] = (unsigned char)t.days;
+    f[13] = (unsigned char)(t.days >> 8);
+    f[14] = sunset_h;
+    f[15] = sunset_m;
+    f[16] = sunrise_h;
+    f[17] = sunrise_m;
+    f[18] = log_seq;
+
+    Frame_Send(CMD_READ_ALL | FRAME_REPLY, f, sizeof(f));
+}
+
+#if ENERGY_STATS
+// Counters since reset, 32-bit little endian, in two pages to fit the ring:
+//   page 0: lit seconds per band (ENERGY_BANDS), full-power seconds
+//   page 1: switch-ons, motion onsets, LCD bytes, then the last full
+//           hour's full-power seconds and motion onsets, 16 bits each
+// Other pages get no answer.
+void Send_Energy(unsigned char page)
+{
+    unsigned char f[4 * ENERGY_BANDS + 5 > 17 ? 4 * ENERGY_BANDS + 5 : 17];
+    unsigned char n = 1, i;
+    unsigned long lcd;
+    energy_t e;
+
+    Energy_Snapshot(&e);
+    f[0] = page;
+    if(page == 0)
+    {
+        for(i = 0; i < ENERGY_BANDS; i++, n += 4)
+            Pack_32(f + n, e.on[i]);
+        Pack_32(f + n, e.energy);
+        n += 4;
+    }
+    else if(page == 1)
+    {
+        INTCONbits.GIE = 0;
+        lcd = lcd_bytes;
+        INTCONbits.GIE = 1;
+
+        Pack_32(f + 1, e.switch_on);
+        Pack_32(f + 5, motion_count);
+        Pack_32(f + 9, lcd);
+        f[13] = (unsigned char)en_last_energy;
+        f[14] = (unsigned char)(en_last_energy >> 8);
+        f[15] = (unsigned char)en_last_motion;
+        f[16] = (unsigned char)(en_last_motion >> 8);
+        n = 17;
+    }
+    else
+        return;
+
+    Frame_Send(CMD_GET_ENERGY | FRAME_REPLY, f, n);
+}
+
+void Pack_32(unsigned char* p, unsigned long v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+#endif
+
+// Status frames every cfg.stream_ms, so the period can change at run time
+void Task_Telemetry(void)
+{
+    unsigned int now = Ticks_Now();
+
+    if(cfg.stream_ms && (unsigned int)(now - stream_at) >= stream_ticks)
+    {
+        stream_at = now;
+        Send_Status();
+    }
+    TASK_DONE(TASK_ID_TELEM);
+}
+#endif
+
+// ================= EEPROM =================
+// Waits for queued writes: a write in flight owns EEADR/EEDATA
+unsigned char EE_Read(unsigned char addr)
+{
+    while(ee_busy);
+
+    EEADR = addr;
+    EECON1bits.EEPGD = 0;
+    EECON1bits.RD = 1;
+    return EEDATA;
+}
+
+// Queue one byte; the write itself completes in the background
+unsigned char EE_Write(unsigned char addr, unsigned char dat)
+{
+    unsigned char next = (eeq_head + 1) & EEQ_MASK;
+
+    if(next == eeq_tail) return 0;      // full
+
+    eeq_addr[eeq_head] = addr;
+    eeq_data[eeq_head] = dat;
+    eeq_head = next;
+
+    INTCONbits.GIE = 0;
+    if(!ee_busy)
+    {
+        ee_busy = 1;
+        EE_Start();
+    }
+    INTCONbits.GIE = 1;
+    return 1;
+}
+
+// Start the write at the queue tail. GIE must be off: from ISR() or with
+// it masked, as the 55h/AAh unlock sequence cannot be interrupted.
+void EE_Start(void)
+{
+    EEADR  = eeq_addr[eeq_tail];
+    EEDATA = eeq_data[eeq_tail];
+    eeq_tail = (eeq_tail + 1) & EEQ_MASK;
+
+    EECON1bits.EEPGD = 0;
+    EECON1bits.WREN = 1;
+    EECON2 = 0x55;
+    EECON2 = 0xAA;
+    EECON1bits.WR = 1;
+    EECON1bits.WREN = 0;
+}
+
+// ================= EVENT LOG =================
+// Slots 0..h hold this lap's records, so seq[i] - seq[0] == i exactly up
+// to the newest slot h and never after it: binary search, ~6 reads.
+void Log_Init(void)
+{
+    unsigned char lo, hi, mid, s0, slot, type, k;
+    unsigned char b0, b1, found = 0;
+
+    if((EE_Read(LOG_BASE) >> 5) == LOG_EMPTY) return;      // blank log
+
+    s0 = EE_Read(LOG_BASE + 3);
+    lo = 0;
+    hi = LOG_SLOTS - 1;
+    while(lo < hi)
+    {
+        mid = (lo + hi + 1) >> 1;
+        if((unsigned char)(EE_Read(LOG_BASE + mid * LOG_REC_SIZE + 3) - s0) == mid)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    log_seq  = EE_Read(LOG_BASE + lo * LOG_REC_SIZE + 3) + 1;
+    log_slot = (lo + 1 < LOG_SLOTS) ? lo + 1 : 0;
+
+    // the day count from the newest timed record, then the last sunrise
+    // and sunset; LOG_ENERGY records between them are skipped
+    for(k = 0, slot = lo; k < LOG_SLOTS && found != 7; k++)
+    {
+        b0 = EE_Read(LOG_BASE + slot * LOG_REC_SIZE);
+        b1 = EE_Read(LOG_BASE + slot * LOG_REC_SIZE + 1);
+        type = b0 >> 5;
+
+        if(type == LOG_EMPTY) break;
+        if(type != LOG_ENERGY && !(found & 4))
+        {
+            days = ((unsigned int)(b1 & 0x03) << 8)
+                 | EE_Read(LOG_BASE + slot * LOG_REC_SIZE + 2);
+            found |= 4;
+        }
+        if(type == LOG_SUNRISE && !(found & 1))
+        {
+            sunrise_h = b0 & 0x1F;
+            sunrise_m = b1 >> 2;
+            found |= 1;
+        }
+        if(type == LOG_SUNSET && !(found & 2))
+        {
+            sunset_h = b0 & 0x1F;
+            sunset_m = b1 >> 2;
+            found |= 2;
+        }
+        slot = slot ? slot - 1 : LOG_SLOTS - 1;
+    }
+}
+
+// Append a record stamped with the current time; dropped if the write
+// queue cannot take all four bytes, or if hour would not fit its 5 bits
+void Log_Event(unsigned char type, const rtc_snap_t* t)
+{
+    Log_Record(type, t->hours,
+               (unsigned char)((t->minutes << 2) | ((t->days >> 8) & 0x03)),
+               (unsigned char)t->days);
+}
+
+void Log_Record(unsigned char type, unsigned char hour, unsigned char b1, unsigned char b2)
+{
+    unsigned char addr = LOG_BASE + log_slot * LOG_REC_SIZE;
+
+    if(((eeq_tail - eeq_head - 1) & EEQ_MASK) < LOG_REC_SIZE || hour > 23) return;
+
+    EE_Write(addr,     (unsigned char)((type << 5) | (hour & 0x1F)));
+    EE_Write(addr + 1, b1);
+    EE_Write(addr + 2, b2);
+    EE_Write(addr + 3, log_seq);        // last: a torn record stays stale
+
+    log_seq++;
+    if(++log_slot >= LOG_SLOTS) log_slot = 0;
 }
 
-void LCD_Clear(void)
+#if ENERGY_STATS
+// From Task_Log() when the hour changes: log the hour that ended and count
+// the next. The first call after reset only starts counting, so the first
+// record covers part of an hour.
+void Energy_Hour(const rtc_snap_t* t)
 {
-    LCD_Command(0x01);
-    __delay_ms(2);
+    energy_t e;
+    unsigned long m = motion_count - en_motion_at;
+
+    Energy_Snapshot(&e);
+    if(en_hour < 24)
+    {
+        en_last_energy = (unsigned int)(e.energy - en_energy_at);
+        en_last_motion = m > 0xFFFF ? 0xFFFF : (unsigned int)m;
+        Log_Record(LOG_ENERGY, en_hour, (unsigned char)(en_last_energy >> 4),
+                   m > 255 ? 255 : (unsigned char)m);
+    }
+    en_hour = t->hours;
+    en_energy_at = e.energy;
+    en_motion_at = motion_count;
 }
+#endif
 
-void LCD_SetCursor(unsigned char row, unsigned char col)
+// ================= CONFIGURATION =================
+// Defaults unless the EEPROM block is intact and of this version
+void Config_Load(void)
 {
-    LCD_Command((row == 1 ? 0x80 : 0xC0) + col - 1);
+    unsigned char b[CFG_EE_SIZE];
+    unsigned char i, crc = 0;
+
+    for(i = 0; i < CFG_EE_SIZE; i++)
+    {
+        b[i] = EE_Read(CFG_BASE + i);
+        if(i < CFG_EE_SIZE - 1) crc = crc8_table[crc ^ b[i]];
+    }
+
+    if(b[0] != CFG_VERSION || b[CFG_EE_SIZE - 1] != crc || !Config_Unpack(b + 1))
+        Config_Defaults();
 }
 
-// ================= LCD DISPLAY =================
-void Update_Display(unsigned char isNight, unsigned char motion, unsigned char level)
+// Queue the whole block or nothing; the CRC catches a write cut short
+unsigned char Config_Save(void)
 {
-    LCD_SetCursor(1,1);
-    LCD_String(isNight ? "Night " : "Day   ");
+    unsigned char b[CFG_EE_SIZE];
+    unsigned char i, crc = 0;
 
-    LCD_String("M:");
-    LCD_String(motion ? "YES " : "NO  ");
+    if(((eeq_tail - eeq_head - 1) & EEQ_MASK) < CFG_EE_SIZE) return 0;
 
-    LCD_SetCursor(2,1);
-    LCD_String("Light:");
+    b[0] = CFG_VERSION;
+    Config_Pack(b + 1);
+    for(i = 0; i < CFG_EE_SIZE - 1; i++) crc = crc8_table[crc ^ b[i]];
+    b[CFG_EE_SIZE - 1] = crc;
 
-    if(level == 2)       LCD_String("ON   ");
-    else                 LCD_String("OFF  ");
+    for(i = 0; i < CFG_EE_SIZE; i++) EE_Write(CFG_BASE + i, b[i]);
+    return 1;
 }
@@ -0,0 +1,111 @@
+/*
+ * File:   prof.c
+ * Description: Optional cycle profiling, see prof.h
+ * Microcontroller: PIC16F877A
+ */
+
+#include "prof.h"
+
+#if PROFILE
+prof_t prof[PROF_REGIONS];
+unsigned int prof_t0[PROF_REGIONS];     // PROF_BEGIN() or last PROF_LAP()
+unsigned char prof_lap[PROF_REGIONS];   // prof_t0 holds a lap mark
+
+void Prof_Clear(void);
+
+void Prof_Init(void)
+{
+    Prof_Clear();
+
+    T1CON = 0x00;               // Fosc/4, 1:1
+    TMR1H = 0;
+    TMR1L = 0;
+    T1CONbits.TMR1ON = 1;
+}
+
+// Start the statistics over, with interrupts running
+void Prof_Reset(void)
+{
+    INTCONbits.GIE = 0;
+    Prof_Clear();
+    INTCONbits.GIE = 1;
+}
+
+void Prof_Clear(void)
+{
+    unsigned char r;
+
+    for(r = 0; r < PROF_REGIONS; r++)
+    {
+        prof[r].min  = 0xFFFF;
+        prof[r].max  = 0;
+        prof[r].seen = 0;
+        prof_lap[r]  = 0;
+    }
+}
+
+// High, low, high again: a carry between the two bytes shows up as a
+// changed high byte and the read is repeated
+unsigned int Prof_Now(void)
+{
+    unsigned char h, l;
+
+    do
+    {
+        h = TMR1H;
+        l = TMR1L;
+    } while(h != TMR1H);
+
+    return ((unsigned int)h << 8) | l;
+}
+
+// From ISR() for PROF_ISR/PROF_LAT, from main() for the others
+void Prof_Add(unsigned char r, unsigned int dt)
+{
+    prof_t *p = &prof[r];
+
+    if(dt < p->min) p->min = dt;
+    if(dt > p->max) p->max = dt;
+
+    if(p->seen)
+        p->avg += dt - (p->avg >> PROF_AVG_SHIFT);
+    else
+    {
+        p->avg = (unsigned long)dt << PROF_AVG_SHIFT;
+        p->seen = 1;
+    }
+}
+
+// Time since the previous lap; the first call only sets the mark
+void Prof_Lap(unsigned char r)
+{
+    unsigned int now = Prof_Now();
+
+    if(prof_lap[r])
+        Prof_Add(r, now - prof_t0[r]);
+    prof_lap[r] = 1;
+    prof_t0[r] = now;
+}
+
+// min, max, avg per region, little endian, 6 * PROF_REGIONS bytes; GIE
+// is held off so the ISR regions are not torn mid-copy
+void Prof_Read(unsigned char* b)
+{
+    unsigned char r;
+    unsigned int avg;
+
+    for(r = 0; r < PROF_REGIONS; r++)
+    {
+        INTCONbits.GIE = 0;
+        avg  = (unsigned int)(prof[r].avg >> PROF_AVG_SHIFT);
+        b[0] = (unsigned char)prof[r].min;
+        b[1] = (unsigned char)(prof[r].min >> 8);
+        b[2] = (unsigned char)prof[r].max;
+        b[3] = (unsigned char)(prof[r].max >> 8);
+        INTCONbits.GIE = 1;
+        b[4] = (unsigned char)avg;
+        b[5] = (unsigned char)(avg >> 8);
+        b += 6;
+    }
+}
+#endif
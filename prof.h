@@ -0,0 +1,90 @@
+/*
+ * File:   prof.h
+ * Description: Optional cycle profiling of hot paths with Timer1
+ * Microcontroller: PIC16F877A
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include "hal.h"
+#include "config.h"
+
+// PROFILE (config.h) runs Timer1 free from Fosc/4 at 1:1, so every count
+// is one instruction cycle and a region may take up to 65535 of them
+// (13 ms at 20 MHz) before it wraps. Each region keeps min, max and a
+// shift-only running average (1/2^PROF_AVG_SHIFT per sample) in RAM.
+// Without PROFILE the macros below expand to nothing.
+#define PROF_ISR     0          // ISR() body, entry to exit
+#define PROF_LAT     1          // Timer2 match to ISR() entry, RTC_T2_PRE-cycle steps
+#define PROF_LOOP    2          // one scheduler pass in main()
+#define PROF_FLUSH   3          // Task_Display(): pages + LCD_Flush()
+#define PROF_REGIONS 4
+
+#define PROF_AVG_SHIFT 4
+
+// HIL_PROBES (config.h, main.c only): timing marks for a logic analyzer,
+// independent of PROFILE. Together with RC1 (lamp) and RD3 (LCD E, one
+// pulse per nibble) they give the budgets in README.md:
+//   RE0  high for the ISR() body
+//   RE1  toggles once per scheduler pass: edge spacing is the loop period
+//   RE2  high for Task_Display(), pages and LCD_Flush()
+// RE0-2 are AN5-7 and come out of reset analog, reading 0, so PORTE is
+// written whole from the probe_e shadow rather than bit by bit: a bsf or
+// bcf would read the pins back and clear the other probes. The ISR()
+// probe is always low again when the main loop is running, so a write
+// that ISR() lands between read and store still puts the right level.
+#if HIL_PROBES
+extern unsigned char probe_e;
+
+#if LDR_USE_ADC
+#define PROBE_PCFG()    ((void)0)                       // ADC_Init(): 0x8E, AN0 only
+#else
+#define PROBE_PCFG()    (ADCON1 = 0x06)                 // all digital, as ZONE_PINS
+#endif
+#define PROBE_SET(b, v) ((v) ? (probe_e |= (b)) : (probe_e &= ~(b)), PORTE = probe_e)
+#define PROBE_INIT()    (PROBE_PCFG(), TRISE &= 0xE8, probe_e = 0, PORTE = 0)  // RE0-2 out, PSPMODE off
+#define PROBE_ISR(v)    PROBE_SET(0x01, v)
+#define PROBE_LOOP()    (probe_e ^= 0x02, PORTE = probe_e)
+#define PROBE_DISP(v)   PROBE_SET(0x04, v)
+#else
+#define PROBE_INIT()
+#define PROBE_ISR(v)
+#define PROBE_LOOP()
+#define PROBE_DISP(v)
+#endif
+
+#if PROFILE
+#if RTC_USE_TIMER1
+#error "PROFILE needs Timer1, which RTC_USE_TIMER1 uses for the clock"
+#endif
+
+typedef struct
+{
+    unsigned int  min, max;
+    unsigned long avg;          // running average << PROF_AVG_SHIFT
+    unsigned char seen;         // avg seeded
+} prof_t;
+
+extern prof_t prof[PROF_REGIONS];
+extern unsigned int prof_t0[PROF_REGIONS];
+
+#define PROF_BEGIN(r)   (prof_t0[r] = Prof_Now())
+#define PROF_END(r)     Prof_Add(r, Prof_Now() - prof_t0[r])
+#define PROF_LAP(r)     Prof_Lap(r)
+#define PROF_ADD(r, dt) Prof_Add(r, dt)
+
+void Prof_Init(void);
+void Prof_Reset(void);
+unsigned int Prof_Now(void);
+void Prof_Add(unsigned char, unsigned int);
+void Prof_Lap(unsigned char);
+void Prof_Read(unsigned char*);
+#else
+#define PROF_BEGIN(r)
+#define PROF_END(r)
+#define PROF_LAP(r)
+#define PROF_ADD(r, dt)
+#endif
+
+#endif
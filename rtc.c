@@ -0,0 +1,165 @@
+/*
+ * File:   rtc.c
+ * Description: Software RTC, see rtc.h
+ * Microcontroller: PIC16F877A
+ */
+
+#include "rtc.h"
+
+volatile unsigned char seconds = 0;
+volatile unsigned char minutes = 0;
+volatile unsigned char hours   = CLOCK_START_H;
+volatile unsigned int  ticks   = 0;
+volatile unsigned int  days    = 0;
+volatile unsigned long uptime  = 0;
+#if !RTC_USE_TIMER1
+unsigned char rtc_subsec = 0;           // ticks into the current second
+#endif
+
+const unsigned char bcd60[60] =
+{
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+    0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29,
+    0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+    0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+};
+
+#if RTC_USE_TIMER1
+void Timer1_Init(void);
+#endif
+#if USE_TIMER2
+void Timer2_Init(void);
+#endif
+unsigned char RTC_Second(void);
+
+// Timers and the tick interrupt; GIE is left to the application
+void RTC_Init(void)
+{
+#if RTC_USE_TIMER1
+    Timer1_Init();
+#endif
+#if USE_TIMER2
+    Timer2_Init();
+#endif
+#if !RTC_USE_TIMER1
+    PIE1bits.TMR2IE = 1;
+#endif
+}
+
+#if USE_TIMER2
+void Timer2_Init(void)
+{
+    T2CON = 0x00;
+    TMR2  = 0;
+    PR2   = RTC_T2_PR2;
+
+    T2CONbits.T2CKPS0 = (RTC_T2_PRE == 4);
+    T2CONbits.T2CKPS1 = (RTC_T2_PRE == 16);
+    T2CONbits.TOUTPS  = RTC_T2_POST - 1;
+    T2CONbits.TMR2ON = 1;
+}
+#endif
+
+#if RTC_USE_TIMER1
+// Timer1: asynchronous counter on T1CKI, keeps counting during SLEEP
+void Timer1_Init(void)
+{
+    TRISCbits.TRISC0 = 1;       // T1CKI, 32.768 kHz
+    T1CON = 0x00;
+    T1CONbits.TMR1CS  = 1;      // external clock on RC0
+    T1CONbits.nT1SYNC = 1;      // asynchronous
+    TMR1H = 0x80;
+    TMR1L = 0;
+    PIR1bits.TMR1IF = 0;
+    PIE1bits.TMR1IE = 1;
+    T1CONbits.TMR1ON = 1;
+}
+#endif
+
+// Called first thing from ISR(); RTC_EVT_* for what has just happened
+unsigned char RTC_Isr(void)
+{
+#if RTC_USE_TIMER1
+    if(PIR1bits.TMR1IF)
+    {
+        PIR1bits.TMR1IF = 0;
+        TMR1H |= 0x80;          // next overflow in 32768 counts = 1 s
+        ticks++;
+        return RTC_EVT_TICK | RTC_Second();
+    }
+#else
+    if(PIR1bits.TMR2IF)
+    {
+        PIR1bits.TMR2IF = 0;
+        ticks++;
+
+        if(++rtc_subsec >= RTC_TICK_HZ)
+        {
+            rtc_subsec = 0;
+            return RTC_EVT_TICK | RTC_Second();
+        }
+        return RTC_EVT_TICK;
+    }
+#endif
+    return 0;
+}
+
+unsigned char RTC_Second(void)
+{
+    uptime++;
+    seconds++;
+
+    if(seconds < 60) return RTC_EVT_SECOND;
+
+    seconds = 0;
+    minutes++;
+    if(minutes >= 60)
+    {
+        minutes = 0;
+        hours++;
+        if(hours >= 24)
+        {
+            hours = 0;
+            days++;
+        }
+    }
+    return RTC_EVT_SECOND | RTC_EVT_MINUTE;
+}
+
+// ticks is 16 bits wide: read it with the RTC interrupt held off
+unsigned int Ticks_Now(void)
+{
+    unsigned int t;
+
+    INTCONbits.GIE = 0;
+    t = ticks;
+    INTCONbits.GIE = 1;
+    return t;
+}
+
+// The clock spans nine bytes that RTC_Isr() rolls over together, so a
+// plain read can pair 21:59's hour with 22:00's minute. Copy it in one go
+// with interrupts held off: about two dozen instruction cycles, 5 us at
+// 20 MHz, and a pending interrupt is taken right after. Logging, display
+// and telemetry read the clock only through here.
+void RTC_Snapshot(rtc_snap_t* t)
+{
+    INTCONbits.GIE = 0;
+    t->uptime  = uptime;
+    t->days    = days;
+    t->hours   = hours;
+    t->minutes = minutes;
+    t->seconds = seconds;
+    INTCONbits.GIE = 1;
+}
+
+// Two ASCII digits of v, 0..59
+void Fmt_2(char* p, unsigned char v)
+{
+    unsigned char b = bcd60[v];
+
+    p[0] = (b >> 4) + '0';
+    p[1] = (b & 0x0F) + '0';
+}
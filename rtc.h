@@ -0,0 +1,78 @@
+/*
+ * File:   rtc.h
+ * Description: Software RTC on Timer2 (or Timer1/T1CKI), tick counter
+ *              and tear-free clock snapshots
+ * Microcontroller: PIC16F877A
+ */
+
+#ifndef RTC_H
+#define RTC_H
+
+#include "hal.h"
+#include "config.h"
+
+// Default: Timer2 interrupts RTC_T2_HZ times a second and RTC_Isr() counts
+// RTC_TICK_HZ ticks per second; the prescaler, PR2 and the postscaler are
+// derived from _XTAL_FREQ below and must divide it exactly. The smallest
+// prescaler that fits keeps the CCP2 PWM, which runs off Timer2 before the
+// postscaler, as fast as possible.
+// RTC_USE_TIMER1: Timer1 counts a 32.768 kHz clock on RC0/T1CKI as an
+// asynchronous counter, one interrupt per second, and keeps running in
+// SLEEP. The T1OSO/T1OSI crystal pins are not usable because RC1 drives
+// the lamp, so the clock must come from an oscillator module.
+#define RTC_T2_CYCLES (_XTAL_FREQ / 4 / RTC_T2_HZ)              // Tcy per tick
+#define RTC_T2_PRE    (RTC_T2_CYCLES <= 16UL * 256 ? 1 : RTC_T2_CYCLES <= 64UL * 256 ? 4 : 16)
+#define RTC_T2_POST   ((RTC_T2_CYCLES + RTC_T2_PRE * 256UL - 1) / (RTC_T2_PRE * 256UL))
+#define RTC_T2_PR2    (RTC_T2_CYCLES / RTC_T2_PRE / RTC_T2_POST - 1)
+
+#if RTC_T2_POST > 16
+#error "RTC_T2_HZ too low for Timer2 at this _XTAL_FREQ"
+#endif
+#if (_XTAL_FREQ / 4) % RTC_T2_HZ || RTC_T2_CYCLES % (RTC_T2_PRE * RTC_T2_POST)
+#error "RTC_T2_HZ does not divide _XTAL_FREQ into whole Timer2 periods"
+#endif
+#if !RTC_USE_TIMER1 && RTC_T2_CYCLES < 1000
+#error "Timer2 ticks leave ISR() under 1000 cycles at this _XTAL_FREQ: use RTC_USE_TIMER1"
+#endif
+
+#if RTC_USE_TIMER1
+#define RTC_TICK_HZ   1
+#else
+#define RTC_TICK_HZ   RTC_T2_HZ
+#endif
+
+#define USE_TIMER2 (!RTC_USE_TIMER1 || LAMP_USE_PWM)
+
+// RTC ticks in ms milliseconds, rounded up
+#define TICKS_MS(ms) ((unsigned int)(((ms) * (unsigned long)RTC_TICK_HZ + 999) / 1000))
+
+// RTC_Isr() result
+#define RTC_EVT_TICK    0x01    // ticks advanced
+#define RTC_EVT_MINUTE  0x02    // and the minute rolled over
+#define RTC_EVT_SECOND  0x04    // and the second
+
+// Consistent copy of the clock kept by RTC_Isr(), see RTC_Snapshot()
+typedef struct
+{
+    unsigned long uptime;
+    unsigned int  days;
+    unsigned char hours, minutes, seconds;
+} rtc_snap_t;
+
+extern volatile unsigned char seconds;
+extern volatile unsigned char minutes;
+extern volatile unsigned char hours;
+extern volatile unsigned int  ticks;    // RTC ticks, for timestamps
+extern volatile unsigned int  days;     // midnights since the log began
+extern volatile unsigned long uptime;   // seconds since reset
+
+// Packed BCD of 0..59, tens in the high nibble: digits without a divide
+extern const unsigned char bcd60[60];
+
+void RTC_Init(void);
+unsigned char RTC_Isr(void);
+unsigned int Ticks_Now(void);
+void RTC_Snapshot(rtc_snap_t*);
+void Fmt_2(char*, unsigned char);
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * File:   hal_host.c
+ * Description: Storage for the registers declared in hal_host.h
+ */
+
+#include "hal_host.h"
+
+volatile hal_portb_t PORTBbits;
+volatile hal_portc_t PORTCbits;
+volatile hal_portd_t PORTDbits;
+volatile hal_trisa_t TRISAbits;
+volatile hal_trisb_t TRISBbits;
+volatile hal_trisc_t TRISCbits;
+
+volatile unsigned char RD0, RD1, RD2, RD3, RD4, RD5, RD6, RD7;
+volatile unsigned char PORTA, TRISD, TMR0, TMR1H, TMR1L, TMR2, PR2, T1CON, T2CON;
+volatile unsigned char CCPR2L, CCP2CON, ADCON0, ADCON1, ADRESH, ADRESL;
+
+volatile hal_intcon_t  INTCONbits;
+volatile hal_option_t  OPTION_REGbits;
+volatile hal_pir1_t    PIR1bits;
+volatile hal_pie1_t    PIE1bits;
+volatile hal_t1con_t   T1CONbits;
+volatile hal_t2con_t   T2CONbits;
+volatile hal_ccp2con_t CCP2CONbits;
+volatile hal_adcon0_t  ADCON0bits;
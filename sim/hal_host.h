@@ -0,0 +1,71 @@
+/*
+ * File:   hal_host.h
+ * Description: Host stand-in for <xc.h>: the PIC16F877A registers used by
+ *              the shared modules, as plain variables (see hal.h)
+ */
+
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+// Only what lcd.c, rtc.c, io.c, ctrl.c and display.c touch. Writes land in
+// RAM and nothing happens on their own: sim/replay.c sets the input pins
+// and the interrupt flags and calls the handlers itself. Delays cost no
+// time, so a replay runs as fast as the host can execute the logic.
+#define __delay_ms(x)   ((void)0)
+#define __delay_us(x)   ((void)0)
+#define NOP()           ((void)0)
+
+#define HAL_BITS8(p) struct { unsigned p##0:1, p##1:1, p##2:1, p##3:1, \
+                                       p##4:1, p##5:1, p##6:1, p##7:1; }
+
+typedef union { HAL_BITS8(RB); unsigned char v; } hal_portb_t;
+typedef union { HAL_BITS8(RC); unsigned char v; } hal_portc_t;
+typedef union { HAL_BITS8(RD); unsigned char v; } hal_portd_t;
+typedef union { HAL_BITS8(TRISA); unsigned char v; } hal_trisa_t;
+typedef union { HAL_BITS8(TRISB); unsigned char v; } hal_trisb_t;
+typedef union { HAL_BITS8(TRISC); unsigned char v; } hal_trisc_t;
+
+extern volatile hal_portb_t PORTBbits;
+extern volatile hal_portc_t PORTCbits;
+extern volatile hal_portd_t PORTDbits;
+extern volatile hal_trisa_t TRISAbits;
+extern volatile hal_trisb_t TRISBbits;
+extern volatile hal_trisc_t TRISCbits;
+
+#define PORTB   (PORTBbits.v)
+#define TRISA   (TRISAbits.v)
+#define TRISB   (TRISBbits.v)
+#define PORTD   (PORTDbits.v)
+
+// The LCD's legacy RDx names, kept apart from PORTDbits: as macros onto
+// it they would also rewrite PORTDbits.RD2 itself
+extern volatile unsigned char RD0, RD1, RD2, RD3, RD4, RD5, RD6, RD7;
+
+extern volatile unsigned char PORTA, TRISD, TMR0, TMR1H, TMR1L, TMR2, PR2, T1CON, T2CON;
+extern volatile unsigned char CCPR2L, CCP2CON, ADCON0, ADCON1, ADRESH, ADRESL;
+
+typedef struct { unsigned RBIF:1, INTF:1, TMR0IF:1, RBIE:1,
+                 INTE:1, TMR0IE:1, PEIE:1, GIE:1; } hal_intcon_t;
+typedef struct { unsigned PS:3, PSA:1, T0SE:1, T0CS:1,
+                 INTEDG:1, nRBPU:1; } hal_option_t;
+typedef struct { unsigned TMR1IF:1, TMR2IF:1, CCP1IF:1, SSPIF:1,
+                 TXIF:1, RCIF:1, ADIF:1, PSPIF:1; } hal_pir1_t;
+typedef struct { unsigned TMR1IE:1, TMR2IE:1, CCP1IE:1, SSPIE:1,
+                 TXIE:1, RCIE:1, ADIE:1, PSPIE:1; } hal_pie1_t;
+typedef struct { unsigned TMR1ON:1, TMR1CS:1, nT1SYNC:1,
+                 T1OSCEN:1, T1CKPS:2; } hal_t1con_t;
+typedef struct { unsigned T2CKPS0:1, T2CKPS1:1, TMR2ON:1,
+                 TOUTPS:4; } hal_t2con_t;
+typedef struct { unsigned CCP2M:4, CCP2Y:1, CCP2X:1; } hal_ccp2con_t;
+typedef struct { unsigned ADON:1, :1, GO_nDONE:1, CHS:3, ADCS:2; } hal_adcon0_t;
+
+extern volatile hal_intcon_t  INTCONbits;
+extern volatile hal_option_t  OPTION_REGbits;
+extern volatile hal_pir1_t    PIR1bits;
+extern volatile hal_pie1_t    PIE1bits;
+extern volatile hal_t1con_t   T1CONbits;
+extern volatile hal_t2con_t   T2CONbits;
+extern volatile hal_ccp2con_t CCP2CONbits;
+extern volatile hal_adcon0_t  ADCON0bits;
+
+#endif
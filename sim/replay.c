@@ -0,0 +1,482 @@
+/*
+ * File:   replay.c
+ * Description: Host replay of recorded LDR/PIR traces through the
+ *              controller logic, with lamp and LCD statistics per hour
+ *
+ * Build and run from the repository root, with any config.h switch
+ * overridden by -D as for the target:
+ *   cc -O2 -DHAL_HOST -I. sim/replay.c sim/hal_host.c ctrl.c display.c \
+ *      lcd.c rtc.c io.c -o replay
+ *   ./replay [-n repeat] [trace]
+ *
+ * A trace is one sample per line, "ms ldr pir", each holding until the
+ * next line; ms counts from power-up (the clock then reads cfg.start_h),
+ * ldr is the ambient level 0..255 and pir 0 or 1. '#' starts a comment.
+ * sim/night.trc is a 24 h example. Without a file the trace is read from
+ * stdin; -n plays it that many times back to back.
+ *
+ * After the statistics the replay checks the timing budgets below and
+ * exits with 2 if any is exceeded, so it can gate a change:
+ *   BUDGET_LIGHT_MS  PIR onset at night to a brighter lamp, worst case
+ *   BUDGET_LCD_AVG   bytes to the panel per display pass, on average
+ *   BUDGET_LCD_MAX   bytes in any one display pass
+ *   BUDGET_HOLD_MS   end of a motion hold after hold_ticks from
+ *                    motion_stamp, worst case (MOTION_STAMP builds); a
+ *                    hold that ends before that fails as well
+ * Each can be set with -D like the config.h switches. Latency is measured
+ * in RTC ticks, so below one tick it reads 0. Loop and ISR cycle counts
+ * need the target: see prof.h. LAMP_WAVE builds also feed the CMD_WAVE
+ * matcher a few byte streams and fail the same way if one is misread.
+ *
+ * Time advances one RTC tick per loop. The trace sample drives the input
+ * pins, raising INTF or RBIF on an edge where the build enables them, the
+ * RTC interrupt is raised and Ctrl_Isr() called as ISR() calls it, then
+ * Tasks_Run() takes the input, lamp, display and log tasks at the
+ * periods in ctrl.h. Debouncing, input events, the energy counters, the
+ * schedule and the zones all run as on the target; only the UART tasks,
+ * and with them the motion broadcasts of LAMP_WAVE, are left out. The LCD
+ * costs no delays here, so a day replays in well under a second. Digital
+ * LDR builds see the trace level on RB0 through a comparator at the
+ * midpoint of LDR_DARK_LEVEL and LDR_LIGHT_LEVEL; in LDR_USE_ADC builds
+ * each conversion Ctrl_Input() starts returns it, scaled to 10 bits,
+ * to IO_Isr()'s filter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "lcd.h"
+#include "rtc.h"
+#include "io.h"
+#include "ctrl.h"
+#include "display.h"
+
+#define LDR_MIDPOINT  ((LDR_DARK_LEVEL + LDR_LIGHT_LEVEL) / 2)
+#define HOUR_TICKS    (3600UL * RTC_TICK_HZ)
+#define TRACE_MAX     100000
+
+// Timing budgets. A Timer1 RTC runs the tasks once a second, so each
+// display pass there carries a whole second of changes.
+#ifndef BUDGET_LIGHT_MS
+#if RTC_USE_TIMER1
+#define BUDGET_LIGHT_MS  1000
+#else
+#define BUDGET_LIGHT_MS  50
+#endif
+#endif
+#ifndef BUDGET_LCD_AVG
+#if RTC_USE_TIMER1
+#define BUDGET_LCD_AVG   10.0
+#else
+#define BUDGET_LCD_AVG   1.5
+#endif
+#endif
+#ifndef BUDGET_LCD_MAX
+#define BUDGET_LCD_MAX   40     // a full page: 32 cells and 2 line addresses, rounded up
+#endif
+#ifndef BUDGET_HOLD_MS
+#if RTC_USE_TIMER1
+#define BUDGET_HOLD_MS   1000
+#else
+#define BUDGET_HOLD_MS   TASK_LAMP_MS   // Ctrl_Lamp() looks once a period
+#endif
+#endif
+
+typedef struct
+{
+    unsigned long ms;
+    unsigned char ldr, pir;
+} sample_t;
+
+typedef struct
+{
+    unsigned long on;           // ticks with the lamp lit
+    double        energy;       // ticks at full-power equivalent
+    unsigned long switch_on;    // off -> lit transitions
+    unsigned long steps;        // level changes of any size
+    unsigned long lcd;          // bytes to the panel
+} stats_t;
+
+sample_t trace[TRACE_MAX];
+unsigned long trace_len = 0;
+
+unsigned char in_ldr, in_pir;   // trace sample in effect
+unsigned long adc_starts = 0;   // LDR_USE_ADC: conversions started
+unsigned long refreshes = 0;    // display passes
+unsigned long refresh_max = 0;  // most bytes in one of them
+
+int Trace_Load(FILE* f);
+void Sim_Init(void);
+void Sim_Pins(void);
+void Sim_Tick(void);
+void Sim_Display(void);
+void Sim_Log(void);
+void Stats_Print(const char* label, const stats_t* s, double hours);
+int Budget(const char* name, double value, double limit, const char* unit);
+#if LAMP_WAVE
+int Wave_Check(void);
+#endif
+
+// main()'s table without the UART tasks
+task_t tasks[] =
+{
+    { TICKS_MS(TASK_INPUT_MS),   0, 1, Ctrl_Input  },
+    { TICKS_MS(TASK_LAMP_MS),    0, 1, Ctrl_Output },
+    { TICKS_MS(TASK_DISPLAY_MS), 0, 0, Sim_Display },
+    { TICKS_MS(TASK_LOG_MS),     0, 0, Sim_Log     },
+};
+#define NUM_TASKS (sizeof(tasks) / sizeof(tasks[0]))
+
+int main(int argc, char** argv)
+{
+    FILE* f = stdin;
+    unsigned long repeat = 1, lap, i, tick, end;
+    unsigned long hour_end, hour_no = 0;
+    unsigned long wait_at = 0, light_max = 0, lit_count = 0;
+    unsigned char prev, prev_pir, wait = 0, wait_from = 0;
+#if MOTION_STAMP
+    unsigned char held = 0;
+    long hold_late = 0, hold_early = 0;
+    unsigned long hold_count = 0;
+#endif
+    int over;
+    stats_t hour, total;
+    clock_t t0;
+    double wall, sim_s;
+    int a;
+
+    for(a = 1; a < argc; a++)
+    {
+        if(!strcmp(argv[a], "-n") && a + 1 < argc)
+            repeat = strtoul(argv[++a], NULL, 0);
+        else if(!(f = fopen(argv[a], "r")))
+        {
+            perror(argv[a]);
+            return 1;
+        }
+    }
+    if(Trace_Load(f) || trace_len == 0 || repeat == 0)
+    {
+        fprintf(stderr, "usage: replay [-n repeat] [trace]\n");
+        return 1;
+    }
+
+    in_ldr = trace[0].ldr;
+    in_pir = trace[0].pir;
+    Sim_Init();
+    memset(&hour, 0, sizeof(hour));
+    memset(&total, 0, sizeof(total));
+    prev = brightness;
+    prev_pir = in_pir;
+    tick = 0;
+    hour_end = HOUR_TICKS;
+    end = (trace[trace_len - 1].ms * RTC_TICK_HZ) / 1000 + 1;
+
+    printf("hour   lamp-on s  energy %%  switch-ons  level steps  LCD bytes\n");
+    t0 = clock();
+    for(lap = 0; lap < repeat; lap++)
+    {
+        unsigned long base = tick;
+
+        for(i = 0; i < trace_len; i++)
+        {
+            unsigned long until = (i + 1 < trace_len)
+                ? base + (trace[i + 1].ms * RTC_TICK_HZ) / 1000
+                : base + end;
+
+            in_ldr = trace[i].ldr;
+            in_pir = trace[i].pir;
+
+            for(; tick < until; tick++)
+            {
+                // motion-to-light latency, from the onset at night; the
+                // lamp may come on within this tick, from the ISR
+                if(in_pir && !prev_pir && isNight && brightness < LAMP_FULL)
+                {
+                    wait = 1;
+                    wait_at = tick;
+                    wait_from = brightness;
+                }
+                prev_pir = in_pir;
+
+                Sim_Pins();
+                Sim_Tick();
+                Tasks_Run(tasks, NUM_TASKS);
+#if MOTION_STAMP
+                if(held && !lamp_holding && isNight)    // the hold ran out
+                {
+                    long late = (long)(unsigned int)(ticks - motion_stamp) - (long)hold_ticks;
+
+                    if(late > hold_late) hold_late = late;
+                    if(late < hold_early) hold_early = late;
+                    hold_count++;
+                }
+                held = lamp_holding;
+#endif
+#if LDR_USE_ADC
+                if(ADCON0bits.GO_nDONE)         // done by the next tick
+                {
+                    unsigned int x = (unsigned int)in_ldr << 2;
+
+                    ADRESH = (unsigned char)(x >> 8);
+                    ADRESL = (unsigned char)x;
+                    ADCON0bits.GO_nDONE = 0;
+                    PIR1bits.ADIF = 1;
+                    adc_starts++;
+                }
+#endif
+
+                if(brightness)
+                {
+                    hour.on++;
+#if LAMP_USE_PWM
+                    hour.energy += (double)lamp_curve[brightness] / PWM_DUTY_MAX;
+#else
+                    hour.energy += 1;
+#endif
+                }
+                if(wait && brightness > wait_from)
+                {
+                    if(tick - wait_at > light_max) light_max = tick - wait_at;
+                    lit_count++;
+                    wait = 0;
+                }
+                else if(wait && (!in_pir || !isNight))
+                    wait = 0;           // too short to debounce, or day came
+
+                if(brightness != prev)
+                {
+                    if(!prev) hour.switch_on++;
+                    hour.steps++;
+                    prev = brightness;
+                }
+
+                if(tick + 1 == hour_end)
+                {
+                    char label[8];
+
+                    hour.lcd = lcd_bytes - total.lcd;
+                    sprintf(label, "%02lu:00", (cfg.start_h + hour_no++) % 24);
+                    Stats_Print(label, &hour, 1.0);
+
+                    total.on += hour.on;
+                    total.energy += hour.energy;
+                    total.switch_on += hour.switch_on;
+                    total.steps += hour.steps;
+                    total.lcd = lcd_bytes;
+                    memset(&hour, 0, sizeof(hour));
+                    hour_end += HOUR_TICKS;
+                }
+            }
+        }
+    }
+    wall = (double)(clock() - t0) / CLOCKS_PER_SEC;
+
+    total.on += hour.on;
+    total.energy += hour.energy;
+    total.switch_on += hour.switch_on;
+    total.steps += hour.steps;
+    total.lcd = lcd_bytes;
+
+    sim_s = (double)tick / RTC_TICK_HZ;
+    printf("\n");
+    Stats_Print("avg  ", &total, sim_s / 3600);
+    printf("\n%.0f s simulated in %.3f s CPU", sim_s, wall);
+    if(wall > 0) printf(", %.0fx real time", sim_s / wall);
+    printf("\n");
+#if LDR_USE_ADC
+    printf("%.0f LDR conversions/h\n", adc_starts * 3600 / sim_s);
+#endif
+#if ENERGY_STATS
+    {
+        energy_t e;
+
+        Energy_Snapshot(&e);
+        printf("firmware counters: %lu full-power s, %lu switch-ons\n",
+               e.energy, e.switch_on);
+    }
+#endif
+
+    printf("\nbudget           measured      limit\n");
+    over  = Budget("light latency", light_max * 1000.0 / RTC_TICK_HZ, BUDGET_LIGHT_MS, "ms");
+    over |= Budget("LCD bytes avg", refreshes ? (double)lcd_bytes / refreshes : 0, BUDGET_LCD_AVG, "");
+    over |= Budget("LCD bytes max", refresh_max, BUDGET_LCD_MAX, "");
+#if MOTION_STAMP
+    over |= Budget("hold late", hold_late * 1000.0 / RTC_TICK_HZ, BUDGET_HOLD_MS, "ms");
+    if(hold_early < 0)
+    {
+        printf("hold early     %9.2f ms before motion_stamp + hold\n",
+               -hold_early * 1000.0 / RTC_TICK_HZ);
+        over = 1;
+    }
+#endif
+#if LAMP_WAVE
+    over |= Wave_Check();
+#endif
+    printf("(%lu motion onsets lit at night, %lu display passes", lit_count, refreshes);
+#if MOTION_STAMP
+    printf(", %lu holds", hold_count);
+#endif
+    printf(")\n");
+    return over ? 2 : 0;
+}
+
+// Samples must come in time order; returns nonzero on a malformed line
+int Trace_Load(FILE* f)
+{
+    char line[128];
+    unsigned long ms, n = 0;
+    unsigned int ldr, pir;
+    char* p;
+
+    while(fgets(line, sizeof(line), f))
+    {
+        n++;
+        if((p = strchr(line, '#'))) *p = 0;
+        if(strspn(line, " \t\r\n") == strlen(line)) continue;
+
+        if(sscanf(line, "%lu %u %u", &ms, &ldr, &pir) != 3 || ldr > 255 || pir > 1
+           || (trace_len && ms < trace[trace_len - 1].ms) || trace_len >= TRACE_MAX)
+        {
+            fprintf(stderr, "trace line %lu: bad sample\n", n);
+            return 1;
+        }
+        trace[trace_len].ms  = ms;
+        trace[trace_len].ldr = (unsigned char)ldr;
+        trace[trace_len].pir = (unsigned char)pir;
+        trace_len++;
+    }
+    return 0;
+}
+
+// System_Init() without the EEPROM and UART: defaults straight away
+void Sim_Init(void)
+{
+    Sim_Pins();
+    IO_Init();
+    RTC_Init();
+    Config_Defaults();
+    hours = cfg.start_h;
+#if LAMP_SCHEDULE
+    Sched_Init(hours, 0);
+#endif
+    LCD_Init();
+    Display_Init();
+    LCD_Clear();
+}
+
+// The trace sample onto the input pins, with the edge interrupt flags the
+// hardware would raise
+void Sim_Pins(void)
+{
+#if !LDR_USE_ADC
+    unsigned char ldr = in_ldr < LDR_MIDPOINT;  // high at night
+
+    if(PORTBbits.RB0 != ldr && INTCONbits.INTE && OPTION_REGbits.INTEDG == ldr)
+        INTCONbits.INTF = 1;
+    PORTBbits.RB0 = ldr;
+#endif
+#if PIR_ON_RB4
+    if(PORTBbits.RB4 != in_pir && INTCONbits.RBIE)
+        INTCONbits.RBIF = 1;
+    PORTBbits.RB4 = in_pir;
+#else
+    PORTDbits.RD2 = in_pir;
+#endif
+}
+
+// One RTC interrupt, as ISR() takes it
+void Sim_Tick(void)
+{
+#if RTC_USE_TIMER1
+    PIR1bits.TMR1IF = 1;
+#else
+    PIR1bits.TMR2IF = 1;
+#endif
+    Ctrl_Isr();
+}
+
+// Task_Display() without the probes, and the Timer0 ISR run dry
+void Sim_Display(void)
+{
+    unsigned long at = lcd_bytes;
+
+    Display_Run();
+#if LCD_USE_QUEUE
+    while(INTCONbits.TMR0IE) LCD_QueueTick();
+#endif
+    refreshes++;
+    if(lcd_bytes - at > refresh_max) refresh_max = lcd_bytes - at;
+}
+
+// Task_Log() without the EEPROM
+void Sim_Log(void)
+{
+    rtc_snap_t t;
+
+    if(Ctrl_Sun(&t)) Page_Show(PAGE_SUN);
+}
+
+void Stats_Print(const char* label, const stats_t* s, double hours)
+{
+    printf("%s %10.1f %9.2f %11.1f %12.1f %10.1f\n", label,
+           s->on / (double)RTC_TICK_HZ / hours,
+           100.0 * s->energy / (3600.0 * RTC_TICK_HZ * hours),
+           s->switch_on / hours, s->steps / hours, s->lcd / hours);
+}
+
+// One budget line; nonzero if it is exceeded
+int Budget(const char* name, double value, double limit, const char* unit)
+{
+    int over = value > limit;
+
+    printf("%-14s %9.2f %-2s %8.2f %-2s %s\n", name, value, unit, limit, unit,
+           over ? "OVER" : "ok");
+    return over;
+}
+
+#if LAMP_WAVE
+// Wave_Byte() on a CMD_WAVE frame from the pole below: clean, behind a
+// stray sync, behind a frame the sync cut off, and with a bad CRC. Runs
+// after the replay, whose lamp it may light; nonzero if one is misread.
+int Wave_Check(void)
+{
+    static const struct
+    {
+        const char*   name;
+        unsigned char pre[3], n_pre;
+        unsigned char crc_xor;      // corrupts the CRC
+        unsigned char heard;        // Wave_Rx() should take it
+    } cases[] =
+    {
+        { "clean",    { 0 },                                  0, 0, 1 },
+        { "stray A5", { FRAME_SYNC },                         1, 0, 1 },
+        { "cut off",  { FRAME_SYNC, 4, CMD_WAVE | FRAME_REPLY }, 3, 0, 1 },
+        { "bad CRC",  { 0 },                                  0, 1, 0 },
+    };
+    unsigned char frame[] = { FRAME_SYNC, 2, CMD_WAVE | FRAME_REPLY, 1, WAVE_UP, 0 };
+    unsigned char i, k, self = 3;
+    int bad = 0;
+
+    for(k = 1; k < sizeof(frame) - 1; k++)
+        frame[sizeof(frame) - 1] = crc8_table[frame[sizeof(frame) - 1] ^ frame[k]];
+
+    for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        wave_seen = 0;
+        for(k = 0; k < cases[i].n_pre; k++) Wave_Byte(cases[i].pre[k], self);
+        for(k = 0; k < sizeof(frame); k++)
+            Wave_Byte(frame[k] ^ (k == sizeof(frame) - 1 ? cases[i].crc_xor : 0), self);
+        if((wave_seen & 1) != cases[i].heard)
+        {
+            printf("wave matcher   %s frame misread\n", cases[i].name);
+            bad = 1;
+        }
+    }
+    if(!bad) printf("wave matcher   %u streams ok\n", i);
+    return bad;
+}
+#endif